@@ -31,8 +31,21 @@ LOCAL_VENDOR_MODULE := true
 
 LOCAL_SRC_FILES := audio_hw.c \
     audio_aec.c \
+    beamformer.c \
+    capture_hub.c \
+    eq_coeffs.c \
+    eq_filter.c \
     fifo_wrapper.cpp \
-    fir_filter.c
+    fir_filter.c \
+    gain_ramp.c \
+    iec61937.c \
+    iir_filter.c \
+    mic_preproc.c \
+    pcm_convert.c \
+    proc_budget.c \
+    rt_support.c \
+    standby_timer.c \
+    stream_stats.c
 LOCAL_SHARED_LIBRARIES := liblog libcutils libtinyalsa libaudioroute libaudioutils
 LOCAL_CFLAGS := -Wno-unused-parameter
 LOCAL_C_INCLUDES += \
@@ -42,6 +55,10 @@ LOCAL_C_INCLUDES += \
         system/media/audio_utils/include \
         system/media/audio_effects/include
 
+# Abort on rt_heap allocations from the audio hot path, see rt_support.h
+AUDIO_DEBUG_RT_ALLOC ?= 0
+LOCAL_CFLAGS += -DDEBUG_RT_ALLOC=$(AUDIO_DEBUG_RT_ALLOC)
+
 ifeq ($(TARGET_USE_HDMI_AUDIO),true)
     LOCAL_CFLAGS += -DUSE_HDMI_AUDIO
 endif
@@ -76,6 +76,7 @@
 #include <unistd.h>
 #include <log/log.h>
 #include "audio_aec.h"
+#include "rt_support.h"
 
 #ifdef AEC_HAL
 #include "audio_aec_process.h"
@@ -143,6 +144,18 @@ void flush_aec_fifos(struct aec_t *aec) {
     aec->read_write_diff_bytes = 0;
 }
 
+/* Reader side of aec_reference_discontinuity(). */
+static void realign_reference(struct aec_t* aec) {
+    pthread_mutex_lock(&aec->lock);
+    bool realign = aec->spk_realign;
+    aec->spk_realign = false;
+    pthread_mutex_unlock(&aec->lock);
+    if (realign) {
+        ALOGV("Reference discontinuity, flushing AEC FIFOs");
+        flush_aec_fifos(aec);
+    }
+}
+
 void aec_set_spk_running_no_lock(struct aec_t* aec, bool state) {
     aec->spk_running = state;
 }
@@ -167,10 +180,10 @@ void destroy_aec_mic_config_no_lock(struct aec_t* aec) {
         return;
     }
     release_resampler(aec->spk_resampler);
-    free(aec->mic_buf);
-    free(aec->spk_buf);
-    free(aec->spk_buf_playback_format);
-    free(aec->spk_buf_resampler_out);
+    rt_heap_free(aec->mic_buf);
+    rt_heap_free(aec->spk_buf);
+    rt_heap_free(aec->spk_buf_playback_format);
+    rt_heap_free(aec->spk_buf_resampler_out);
     memset(&aec->last_mic_info, 0, sizeof(struct aec_info));
     aec->mic_initialized = false;
 }
@@ -259,9 +272,11 @@ int init_aec_reference_config(struct aec_t *aec, struct alsa_stream_out *out) {
         destroy_aec_reference_config_no_lock(aec);
     }
 
+    /* The reference is always written as 16-bit samples, whatever the stream format.
+     * The FIFOs are sized for the largest buffer the output may grow to after xruns. */
+    size_t ref_frame_size = out->config.channels * sizeof(int16_t);
     aec->spk_fifo = fifo_init(
-            out->config.period_count * out->config.period_size *
-                audio_stream_out_frame_size(&out->stream),
+            PLAYBACK_MAX_PERIOD_COUNT * out->config.period_size * ref_frame_size,
             false /* reader_throttles_writer */);
     if (aec->spk_fifo == NULL) {
         ALOGE("AEC: Speaker loopback FIFO Init failed!");
@@ -269,7 +284,7 @@ int init_aec_reference_config(struct aec_t *aec, struct alsa_stream_out *out) {
         goto exit;
     }
     aec->ts_fifo = fifo_init(
-            out->config.period_count * sizeof(struct aec_info),
+            PLAYBACK_MAX_PERIOD_COUNT * sizeof(struct aec_info),
             false /* reader_throttles_writer */);
     if (aec->ts_fifo == NULL) {
         ALOGE("AEC: Speaker timestamp FIFO Init failed!");
@@ -279,7 +294,7 @@ int init_aec_reference_config(struct aec_t *aec, struct alsa_stream_out *out) {
     }
 
     aec->spk_sampling_rate = out->config.rate;
-    aec->spk_frame_size_bytes = audio_stream_out_frame_size(&out->stream);
+    aec->spk_frame_size_bytes = ref_frame_size;
     aec->spk_num_channels = out->config.channels;
     aec->spk_initialized = true;
 exit:
@@ -375,6 +390,7 @@ int get_reference_samples(struct aec_t* aec, void* buffer, struct aec_info* info
         ALOGE("%s called with no reference initialized", __func__);
         return -EINVAL;
     }
+    realign_reference(aec);
 
     size_t bytes = info->bytes;
     const size_t frames =
@@ -445,7 +461,7 @@ int get_reference_samples(struct aec_t* aec, void* buffer, struct aec_info* info
     return 0;
 }
 
-int init_aec_mic_config(struct aec_t *aec, struct alsa_stream_in *in) {
+int init_aec_mic_config(struct aec_t* aec, const struct pcm_config* config) {
     ALOGV("%s enter", __func__);
 #if DEBUG_AEC
     remove("/data/local/traces/aec_in.pcm");
@@ -464,12 +480,12 @@ int init_aec_mic_config(struct aec_t *aec, struct alsa_stream_in *in) {
     if (aec->mic_initialized) {
         destroy_aec_mic_config_no_lock(aec);
     }
-    aec->mic_sampling_rate = in->config.rate;
-    aec->mic_frame_size_bytes = audio_stream_in_frame_size(&in->stream);
-    aec->mic_num_channels = in->config.channels;
+    aec->mic_sampling_rate = config->rate;
+    aec->mic_frame_size_bytes = config->channels * (pcm_format_to_bits(config->format) >> 3);
+    aec->mic_num_channels = config->channels;
 
-    aec->mic_buf_size_bytes = in->config.period_size * aec->mic_frame_size_bytes;
-    aec->mic_buf = (int32_t *)malloc(aec->mic_buf_size_bytes);
+    aec->mic_buf_size_bytes = config->period_size * aec->mic_frame_size_bytes;
+    aec->mic_buf = (int32_t *)rt_heap_calloc(1, aec->mic_buf_size_bytes);
     if (aec->mic_buf == NULL) {
         ret = -ENOMEM;
         goto exit;
@@ -477,9 +493,9 @@ int init_aec_mic_config(struct aec_t *aec, struct alsa_stream_in *in) {
     memset(aec->mic_buf, 0, aec->mic_buf_size_bytes);
     /* Reference buffer is the same number of frames as mic,
      * only with a different number of channels in the frame. */
-    aec->spk_buf_size_bytes = in->config.period_size * aec->spk_num_channels *
+    aec->spk_buf_size_bytes = config->period_size * aec->spk_num_channels *
                               aec->mic_frame_size_bytes / aec->mic_num_channels;
-    aec->spk_buf = (int32_t *)malloc(aec->spk_buf_size_bytes);
+    aec->spk_buf = (int32_t *)rt_heap_calloc(1, aec->spk_buf_size_bytes);
     if (aec->spk_buf == NULL) {
         ret = -ENOMEM;
         goto exit_1;
@@ -489,24 +505,24 @@ int init_aec_mic_config(struct aec_t *aec, struct alsa_stream_in *in) {
     /* Pre-resampler buffer */
     size_t spk_frame_out_format_bytes =
             aec->spk_buf_size_bytes * aec->spk_sampling_rate / aec->mic_sampling_rate;
-    aec->spk_buf_playback_format = (int16_t *)malloc(spk_frame_out_format_bytes);
+    aec->spk_buf_playback_format = (int16_t *)rt_heap_calloc(1, spk_frame_out_format_bytes);
     if (aec->spk_buf_playback_format == NULL) {
         ret = -ENOMEM;
         goto exit_2;
     }
     /* Resampler is 16-bit */
-    aec->spk_buf_resampler_out = (int16_t *)malloc(aec->spk_buf_size_bytes);
+    aec->spk_buf_resampler_out = (int16_t *)rt_heap_calloc(1, aec->spk_buf_size_bytes);
     if (aec->spk_buf_resampler_out == NULL) {
         ret = -ENOMEM;
         goto exit_3;
     }
 
     /* Don't use resampler if it's not required */
-    if (in->config.rate == aec->spk_sampling_rate) {
+    if (config->rate == aec->spk_sampling_rate) {
         aec->spk_resampler = NULL;
     } else {
         int resampler_ret = create_resampler(
-                aec->spk_sampling_rate, in->config.rate, aec->num_reference_channels,
+                aec->spk_sampling_rate, config->rate, aec->num_reference_channels,
                 RESAMPLER_QUALITY_MAX - 1, /* MAX - 1 is the real max */
                 NULL,                      /* resampler_buffer_provider */
                 &aec->spk_resampler);
@@ -527,13 +543,13 @@ exit:
     return ret;
 
 exit_4:
-    free(aec->spk_buf_resampler_out);
+    rt_heap_free(aec->spk_buf_resampler_out);
 exit_3:
-    free(aec->spk_buf_playback_format);
+    rt_heap_free(aec->spk_buf_playback_format);
 exit_2:
-    free(aec->spk_buf);
+    rt_heap_free(aec->spk_buf);
 exit_1:
-    free(aec->mic_buf);
+    rt_heap_free(aec->mic_buf);
     pthread_mutex_unlock(&aec->lock);
     ALOGV("%s exit", __func__);
     return ret;
@@ -547,6 +563,18 @@ void aec_set_spk_running(struct aec_t *aec, bool state) {
     ALOGV("%s exit", __func__);
 }
 
+void aec_reference_discontinuity(struct aec_t* aec) {
+    ALOGV("%s enter", __func__);
+    if (aec == NULL) {
+        ALOGV("%s exit", __func__);
+        return;
+    }
+    pthread_mutex_lock(&aec->lock);
+    aec->spk_realign = true;
+    pthread_mutex_unlock(&aec->lock);
+    ALOGV("%s exit", __func__);
+}
+
 bool aec_get_spk_running(struct aec_t *aec) {
     ALOGV("%s enter", __func__);
     pthread_mutex_lock(&aec->lock);
@@ -613,6 +641,7 @@ int process_aec(struct aec_t *aec, void* buffer, struct aec_info *info) {
     if (!aec->prev_spk_running) {
         flush_aec_fifos(aec);
     }
+    realign_reference(aec);
 
     /* If there's no data in FIFO, exit */
     if (fifo_available_to_read(aec->spk_fifo) <= 0) {
@@ -705,4 +734,30 @@ exit:
     return ret;
 }
 
+int skip_aec(struct aec_t* aec, struct aec_info* info) {
+    ALOGV("%s enter", __func__);
+
+    if ((aec == NULL) || (!aec->mic_initialized) || (!aec->spk_initialized)) {
+        return -EINVAL;
+    }
+
+    bool spk_running = aec_get_spk_running(aec);
+    if (spk_running && !aec->prev_spk_running) {
+        flush_aec_fifos(aec);
+    }
+    realign_reference(aec);
+    if (spk_running && (fifo_available_to_read(aec->spk_fifo) > 0)) {
+        struct aec_info spk_info;
+        spk_info.bytes = info->bytes;
+        if (get_reference_samples(aec, aec->spk_buf, &spk_info)) {
+            flush_aec_fifos(aec);
+            aec_spk_mic_reset();
+        }
+    }
+    aec->prev_spk_running = spk_running;
+
+    ALOGV("%s exit", __func__);
+    return 0;
+}
+
 #endif /*#ifdef AEC_HAL*/
@@ -58,6 +58,7 @@ struct aec_t {
     struct resampler_itfe *spk_resampler;
     bool spk_running;
     bool prev_spk_running;
+    bool spk_realign;
 };
 
 struct aec_params {
@@ -88,14 +89,14 @@ int init_aec_reference_config (struct aec_t *aec, struct alsa_stream_out *out);
  * Must be called when the output stream is closed. */
 void destroy_aec_reference_config (struct aec_t *aec);
 
-/* Initialize microphone configuration for AEC.
- * Must be called when a new input stream is opened.
+/* Initialize microphone configuration for AEC from the capture PCM configuration.
+ * Must be called when a new capture session starts.
  * Returns -EINVAL if any processing block fails to initialize,
  * else returns 0. */
-int init_aec_mic_config(struct aec_t* aec, struct alsa_stream_in* in);
+int init_aec_mic_config(struct aec_t* aec, const struct pcm_config* config);
 
 /* Clear microphone configuration for AEC.
- * Must be called when the input stream is closed. */
+ * Must be called when the capture session ends. */
 void destroy_aec_mic_config (struct aec_t *aec);
 
 /* Used to communicate playback state (running or not) to AEC interface.
@@ -105,6 +106,11 @@ void aec_set_spk_running (struct aec_t *aec, bool state);
 /* Used to communicate playback state (running or not) to the caller. */
 bool aec_get_spk_running(struct aec_t* aec);
 
+/* Signal a gap in the reference stream, e.g. a playback underrun. The next reference read drops
+ * whatever is queued, so samples from before and after the gap are never mixed and AEC does not
+ * run on a drifting reference until the timestamp divergence check fires. */
+void aec_reference_discontinuity(struct aec_t* aec);
+
 /* Write audio samples to AEC reference FIFO for use in AEC.
  * Both audio samples and timestamps are added in FIFO fashion.
  * Must be called after every write to PCM.
@@ -130,9 +136,15 @@ int get_reference_samples(struct aec_t* aec, void* buffer, struct aec_info* info
  * Returns -EINVAL if processing fails, else returns 0. */
 int process_aec(struct aec_t* aec, void* buffer, struct aec_info* info);
 
+/* Leave a mic period unprocessed, e.g. when the system is overloaded, but consume the matching
+ * echo reference so the next process_aec() call still lines up with the speaker.
+ * Returns -EINVAL if AEC is not initialized, else 0. */
+int skip_aec(struct aec_t* aec, struct aec_info* info);
+
 #else /* #ifdef AEC_HAL */
 
 #define process_aec(...) ((int)0)
+#define skip_aec(...) ((int)0)
 
 #endif /* #ifdef AEC_HAL */
 
@@ -48,6 +48,9 @@
 
 #include "audio_aec.h"
 #include "audio_hw.h"
+#include "eq_coeffs.h"
+#include "pcm_convert.h"
+#include "rt_support.h"
 
 const struct audio_microphone_characteristic_t kBuiltinMicChars = {
         .device_id = "builtin_mic",
@@ -67,6 +70,15 @@ const struct audio_microphone_characteristic_t kBuiltinMicChars = {
         .geometric_location.z = AUDIO_MICROPHONE_COORDINATE_UNKNOWN,
 };
 
+/* Mic array on the top panel: a square with one mic per corner, 35 mm from the centre, listed
+ * in capture channel order. Used for beamforming, see CAPTURE_BEAMFORMER_PROPERTY. */
+const struct audio_microphone_coordinate kMicArrayLocations[CAPTURE_MIC_ARRAY_CHANNELS] = {
+        {.x = 0.02475f, .y = 0.02475f, .z = 0.0f},
+        {.x = -0.02475f, .y = 0.02475f, .z = 0.0f},
+        {.x = -0.02475f, .y = -0.02475f, .z = 0.0f},
+        {.x = 0.02475f, .y = -0.02475f, .z = 0.0f},
+};
+
 const struct audio_microphone_characteristic_t kEchoReferenceChars = {
         .device_id = "echo_reference",
         .device = AUDIO_DEVICE_IN_ECHO_REFERENCE,
@@ -90,11 +102,12 @@ static int adev_get_microphones(const struct audio_hw_device* dev,
                                 struct audio_microphone_characteristic_t* mic_array,
                                 size_t* mic_count);
 static size_t out_get_buffer_size(const struct audio_stream* stream);
+static uint32_t out_get_latency(const struct audio_stream_out* stream);
 
 static bool is_aec_input(const struct alsa_stream_in* in) {
     /* If AEC is in the app, only configure based on ECHO_REFERENCE spec.
-     * If AEC is in the HAL, configure using the given mic stream. */
-    bool aec_input = true;
+     * If AEC is in the HAL, the capture hub configures it from the mic PCM. */
+    bool aec_input = false;
 #if !defined(AEC_HAL)
     aec_input = (in->source == AUDIO_SOURCE_ECHO_REFERENCE);
 #endif
@@ -152,54 +165,289 @@ static int get_pcm_timestamp(struct pcm* pcm, uint32_t sample_rate, struct aec_i
     return ret;
 }
 
-static int read_filter_from_file(const char* filename, int16_t* filter, int max_length) {
-    FILE* fp = fopen(filename, "r");
-    if (fp == NULL) {
-        ALOGI("%s: File %s not found.", __func__, filename);
-        return 0;
+/* Build a speaker EQ for 'out' from SPEAKER_EQ_FILE. Returns NULL if there is none. */
+static eq_filter_t* out_create_eq(const struct alsa_stream_out* out) {
+    fir_sample_format_t sample_format =
+            (out->format == AUDIO_FORMAT_PCM_16_BIT) ? FIR_SAMPLES_I16 : FIR_SAMPLES_Q31;
+    return eq_cache_create_filter(out->dev->eq_cache, SPEAKER_EQ_FILE, out->config.channels,
+                                  sample_format, out->process_frames);
+}
+
+/* Rebuild the speaker EQ and hand it to out_write(), which crossfades to it. Runs on the
+ * caller's thread and never blocks the writer. */
+static int out_reload_eq(struct alsa_stream_out* out) {
+    eq_filter_t* eq = out_create_eq(out);
+    if (eq == NULL) {
+        return -EINVAL;
     }
-    int num_taps = 0;
-    char* line = NULL;
-    size_t len = 0;
-    while (!feof(fp)) {
-        size_t size = getline(&line, &len, fp);
-        if ((line[0] == '#') || (size < 2)) {
-            continue;
+    /* Free the filter retired by the previous swap, then any filter out_write() never adopted */
+    eq_filter_release(atomic_exchange(&out->retired_eq, NULL));
+    eq_filter_release(atomic_exchange(&out->pending_eq, eq));
+    ALOGI("%s: Speaker EQ reloaded", __func__);
+    return 0;
+}
+
+/* Called by out_write() at a chunk boundary. If a new EQ was published, make it current and
+ * return true with the outgoing filter, possibly NULL, in 'previous'. A new EQ is only adopted
+ * once the previously retired one has been collected, so retired_eq never holds two filters. */
+static bool out_adopt_pending_eq(struct alsa_stream_out* out, eq_filter_t** previous) {
+    if (atomic_load_explicit(&out->retired_eq, memory_order_acquire) != NULL) {
+        return false;
+    }
+    eq_filter_t* eq = atomic_exchange(&out->pending_eq, NULL);
+    if (eq == NULL) {
+        return false;
+    }
+    *previous = out->speaker_eq;
+    out->speaker_eq = eq;
+    return true;
+}
+
+/* Called by out_write() once the chunk that crossfaded away from 'previous' is done. */
+static void out_retire_eq(struct alsa_stream_out* out, eq_filter_t* previous) {
+    if (previous != NULL) {
+        atomic_store_explicit(&out->retired_eq, previous, memory_order_release);
+    }
+}
+
+/* Called by out_write() before each chunk: follow the quality picked by the processing budget.
+ * Reduced quality shortens the speaker EQ, minimal quality bypasses it. Returns true when the
+ * EQ is switched in or out, which the chunk then crossfades. */
+static bool out_apply_budget(struct alsa_stream_out* out) {
+    proc_quality_t quality = out->budget.quality;
+    eq_filter_set_reduced(out->speaker_eq, quality == PROC_QUALITY_REDUCED);
+    bool bypass = (quality == PROC_QUALITY_MINIMAL);
+    if (bypass == out->eq_bypassed) {
+        return false;
+    }
+    if (!bypass) {
+        /* History is stale after a bypass, restart from silence and fade in */
+        eq_filter_reset(out->speaker_eq);
+    }
+    out->eq_bypassed = bypass;
+    return true;
+}
+
+/* Count an underrun. Repeated ones make the buffer more robust: first a later start, then more
+ * periods. Changes take effect when out_write() reopens the PCM. */
+static void out_escalate_xrun(struct alsa_stream_out* out) {
+    uint64_t now_nsec = proc_budget_now_nsec();
+    if (now_nsec - out->xrun_window_start_nsec >
+        (uint64_t)PLAYBACK_XRUN_WINDOW_MS * NANOS_PER_MILLISECOND) {
+        out->xrun_window_start_nsec = now_nsec;
+        out->xrun_window_count = 0;
+    }
+    if (++out->xrun_window_count < PLAYBACK_XRUN_ESCALATE_COUNT) {
+        return;
+    }
+    out->xrun_window_count = 0;
+    if (out->start_threshold_periods + 1 < out->config.period_count) {
+        out->start_threshold_periods++;
+    } else if (out->config.period_count < PLAYBACK_MAX_PERIOD_COUNT) {
+        out->config.period_count++;
+    } else {
+        return;
+    }
+    ALOGW("%s: repeated underruns, now starting after %u of %u periods", __func__,
+          out->start_threshold_periods, out->config.period_count);
+    out->reopen_pcm = true;
+}
+
+/* Classify a failed pcm_write() of 'bytes' from 'buffer' and recover. An underrun (-EPIPE, as
+ * the PCM is opened with PCM_NORESTART) or a suspend is fixed in place with pcm_prepare() and
+ * the chunk written again, so no audio is dropped. Anything else is treated as a lost device
+ * and the PCM is reopened on the next write. Returns 0 once the chunk is written. */
+static int out_recover_write(struct alsa_stream_out* out, int ret, const void* buffer,
+                             size_t bytes) {
+    int err = (ret == -EPIPE) ? EPIPE : errno;
+    if ((err != EPIPE) && (err != ESTRPIPE)) {
+        ALOGE("%s: pcm_write failed: %s", __func__, pcm_get_error(out->pcm));
+        out->reopen_pcm = true;
+        return -err;
+    }
+
+    ALOGW("%s: %s, recovering", __func__, (err == EPIPE) ? "underrun" : "suspended");
+    stream_stats_add_xrun(&out->stats);
+    /* What was queued has played out: the reference restarts from here */
+    aec_reference_discontinuity(out->dev->aec);
+    if (err == EPIPE) {
+        out_escalate_xrun(out);
+    }
+    if (pcm_prepare(out->pcm) != 0) {
+        ALOGE("%s: pcm_prepare failed: %s", __func__, pcm_get_error(out->pcm));
+        out->reopen_pcm = true;
+        return -EIO;
+    }
+    ret = pcm_write(out->pcm, buffer, bytes);
+    if (ret != 0) {
+        ALOGE("%s: pcm_write failed after recovery: %s", __func__, pcm_get_error(out->pcm));
+        out->reopen_pcm = true;
+    }
+    return ret;
+}
+
+/* Open output port 'port' with 'config', making up to 'tries' attempts while it is busy.
+ * Returns NULL on failure. */
+static struct pcm* out_open_pcm(int port, struct pcm_config* config, unsigned int tries)
+{
+    unsigned int pcm_retry_count = tries;
+
+    while (1) {
+        /* PCM_NORESTART: underruns come back as -EPIPE for out_recover_write() */
+        struct pcm* pcm = pcm_open(CARD_OUT, port, PCM_OUT | PCM_MONOTONIC | PCM_NORESTART,
+                                   config);
+        if ((pcm != NULL) && pcm_is_ready(pcm)) {
+            return pcm;
         }
-        int n = sscanf(line, "%" SCNd16 "\n", &filter[num_taps++]);
-        if (n < 1) {
-            ALOGE("Could not find coefficient %d! Exiting...", num_taps - 1);
-            return 0;
+        ALOGE("cannot open pcm_out driver: %s", pcm_get_error(pcm));
+        if (pcm != NULL) {
+            pcm_close(pcm);
         }
-        ALOGV("Coeff %d : %" PRId16, num_taps, filter[num_taps - 1]);
-        if (num_taps == max_length) {
-            ALOGI("%s: max tap length %d reached.", __func__, max_length);
-            break;
+        if (--pcm_retry_count == 0) {
+            ALOGE("Failed to open pcm_out after %u tries", tries);
+            return NULL;
         }
+        usleep(PCM_OPEN_WAIT_TIME_MS * 1000);
     }
-    free(line);
-    fclose(fp);
-    return num_taps;
 }
 
-static void out_set_eq(struct alsa_stream_out* out) {
-    out->speaker_eq = NULL;
-    int16_t* speaker_eq_coeffs = (int16_t*)calloc(SPEAKER_MAX_EQ_LENGTH, sizeof(int16_t));
-    if (speaker_eq_coeffs == NULL) {
-        ALOGE("%s: Failed to allocate speaker EQ", __func__);
+/* reroute_timer callback, on the standby timer thread so out_write() never waits for a PCM to
+ * open. Closes the PCM left behind by the last switch, and gets what a switch to reroute_port
+ * needs ready: a PCM for out_write() to adopt in pending_pcm, and the speaker EQ if the stream
+ * has none yet. */
+static void out_reroute_work(void* context)
+{
+    struct alsa_stream_out* out = (struct alsa_stream_out*)context;
+
+    pthread_mutex_lock(&out->lock);
+    struct pcm* retired_pcm = out->retired_pcm;
+    out->retired_pcm = NULL;
+    int port = out->reroute_port;
+    struct pcm_config config = out->config;
+    bool s32_capable = (out->stage_ref != NULL);
+    bool need_pcm = !out->standby && (port != out->pcm_port) && (out->pending_pcm == NULL);
+    bool need_eq = (port == PORT_INTERNAL_SPEAKER) && (out->speaker_eq == NULL) &&
+                   (atomic_load(&out->pending_eq) == NULL);
+    pthread_mutex_unlock(&out->lock);
+
+    if (retired_pcm != NULL) {
+        pcm_close(retired_pcm);
+    }
+    if (need_eq && (out_reload_eq(out) != 0)) {
+        ALOGE("%s: Failed to initialize speaker EQ", __func__);
+    }
+    if (!need_pcm) {
         return;
     }
-    int num_taps = read_filter_from_file(SPEAKER_EQ_FILE, speaker_eq_coeffs, SPEAKER_MAX_EQ_LENGTH);
-    if (num_taps == 0) {
-        ALOGI("%s: Empty filter file or 0 taps set.", __func__);
-        free(speaker_eq_coeffs);
+
+    /* The sample format was picked for the original port: check what this one takes. Going
+     * back to 32 bits is only possible if the stream was set up for them. */
+    struct pcm_params* params = pcm_params_get(CARD_OUT, port, PCM_OUT);
+    if (params == NULL) {
+        ALOGE("%s: cannot get parameters of port %d", __func__, port);
         return;
     }
-    out->speaker_eq = fir_init(
-            out->config.channels, FIR_SINGLE_FILTER, num_taps,
-            out_get_buffer_size(&out->stream.common) / out->config.channels / sizeof(int16_t),
-            speaker_eq_coeffs);
-    free(speaker_eq_coeffs);
+    if (s32_capable) {
+        config.format = pcm_params_format_test(params, PCM_FORMAT_S32_LE) ? PCM_FORMAT_S32_LE
+                                                                          : PCM_FORMAT_S16_LE;
+    }
+    pcm_params_free(params);
+
+    /* A single attempt, this thread also runs the warm standby closes. Standby and resume will
+     * try again on failure. */
+    struct pcm* pcm = out_open_pcm(port, &config, 1);
+    if (pcm == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&out->lock);
+    if (!out->standby && (port == out->reroute_port) && (out->pending_pcm == NULL) &&
+        (config.period_count == out->config.period_count)) {
+        out->pending_pcm = pcm;
+        out->pending_port = port;
+        out->pending_format = config.format;
+        pcm = NULL;
+    }
+    pthread_mutex_unlock(&out->lock);
+    if (pcm != NULL) {
+        pcm_close(pcm);
+    }
+}
+
+/* Called by out_write() before each chunk. Once a PCM on the new port is ready, the stream
+ * fades out on the old one, then switches at the next chunk boundary and fades back in.
+ * Returns true for the first chunk on the new PCM. */
+static bool out_reroute_step(struct alsa_stream_out* out)
+{
+    if (out->pending_pcm == NULL) {
+        return false;
+    }
+    if (!out->reroute_fading || (out->gain.current != 0) || (out->gain.remaining != 0) ||
+        (out->stage_frames != 0)) {
+        out->reroute_fading = true;
+        return false;
+    }
+
+    if (out->retired_pcm != NULL) {
+        /* The previous switch left a PCM behind: stay silent until the standby timer thread has
+         * closed it, closing it here could block the writer */
+        standby_timer_arm(out->dev->standby_timer, &out->reroute_timer, 0);
+        return false;
+    }
+
+    ALOGI("%s: switching from port %d to %d", __func__, out->pcm_port, out->pending_port);
+    /* The old PCM still has the fade out queued: let it play before closing it */
+    out->retired_pcm = out->pcm;
+    out->pcm = out->pending_pcm;
+    out->pcm_port = out->pending_port;
+    out->config.format = out->pending_format;
+    out->pending_pcm = NULL;
+    out->reroute_fading = false;
+    standby_timer_arm(out->dev->standby_timer, &out->reroute_timer,
+                      out_get_latency(&out->stream));
+    if (out->pcm_port == PORT_INTERNAL_SPEAKER) {
+        eq_filter_reset(out->speaker_eq);
+    }
+    /* The reference now comes from another device, with its own delay */
+    aec_reference_discontinuity(out->dev->aec);
+    return true;
+}
+
+/* Write one processed period to the PCM, and its 16-bit version 'ref_buffer' to the echo
+ * reference. Short writes are staged by out_write() so that this is the only place the PCM is
+ * written to, and its hardware timestamp is read at most once per period. */
+static int out_write_period(struct alsa_stream_out* out, const void* codec_buffer,
+                            const void* ref_buffer)
+{
+    const size_t frames = out->process_frames;
+    const size_t bytes =
+            frames * out->config.channels * (pcm_format_to_bits(out->config.format) >> 3);
+    uint64_t start_nsec = proc_budget_now_nsec();
+    int ret = pcm_write(out->pcm, codec_buffer, bytes);
+    if (ret != 0) {
+        ret = out_recover_write(out, ret, codec_buffer, bytes);
+    }
+    uint64_t now_nsec = proc_budget_now_nsec();
+    stream_stats_add_io(&out->stats, now_nsec - start_nsec, frames, ret != 0);
+    if (ret != 0) {
+        return ret;
+    }
+    out->frames_written += frames;
+
+    struct aec_info info;
+    if (get_pcm_timestamp(out->pcm, out->config.rate, &info, true /*isOutput*/) == 0) {
+        /* 'timestamp' is when the last frame written will be heard */
+        uint64_t presentation_nsec = audio_utils_ns_from_timespec(&info.timestamp);
+        if (presentation_nsec > now_nsec) {
+            stream_stats_add_latency(&out->stats, presentation_nsec - now_nsec);
+        }
+    }
+    out->timestamp = info.timestamp;
+    info.bytes = frames * out->config.channels * sizeof(int16_t);
+    int aec_ret = write_to_reference_fifo(out->dev->aec, (void*)ref_buffer, &info);
+    if (aec_ret) {
+        ALOGE("AEC: Write to speaker loopback FIFO failed!");
+    }
+    return 0;
 }
 
 /* must be called with hw device and output stream mutexes locked */
@@ -210,38 +458,42 @@ static int start_output_stream(struct alsa_stream_out *out)
     /* default to low power: will be corrected in out_write if necessary before first write to
      * tinyalsa.
      */
-    out->write_threshold = PLAYBACK_PERIOD_COUNT * PLAYBACK_PERIOD_SIZE;
-    out->config.start_threshold = PLAYBACK_PERIOD_START_THRESHOLD * PLAYBACK_PERIOD_SIZE;
-    out->config.avail_min = PLAYBACK_PERIOD_SIZE;
+    out->write_threshold = out->config.period_count * out->config.period_size;
+    out->config.start_threshold = out->start_threshold_periods * out->config.period_size;
+    out->config.avail_min = out->config.period_size;
     out->unavailable = true;
-    unsigned int pcm_retry_count = PCM_OPEN_RETRIES;
     int out_port = get_audio_output_port(out->devices);
 
-    while (1) {
-        out->pcm = pcm_open(CARD_OUT, out_port, PCM_OUT | PCM_MONOTONIC, &out->config);
-        if ((out->pcm != NULL) && pcm_is_ready(out->pcm)) {
-            break;
-        } else {
-            ALOGE("cannot open pcm_out driver: %s", pcm_get_error(out->pcm));
-            if (out->pcm != NULL) {
-                pcm_close(out->pcm);
-                out->pcm = NULL;
-            }
-            if (--pcm_retry_count == 0) {
-                ALOGE("Failed to open pcm_out after %d tries", PCM_OPEN_RETRIES);
-                return -ENODEV;
-            }
-            usleep(PCM_OPEN_WAIT_TIME_MS * 1000);
+    if (out->pcm != NULL) {
+        /* Warm standby: the PCM is still prepared, unless the stream moved to another port */
+        if (out->pcm_port == out_port) {
+            out->unavailable = false;
+            adev->active_output = out;
+            return 0;
         }
+        pcm_close(out->pcm);
+        out->pcm = NULL;
+    }
+
+    out->pcm = out_open_pcm(out_port, &out->config, PCM_OPEN_RETRIES);
+    if (out->pcm == NULL) {
+        return -ENODEV;
     }
+    out->pcm_port = out_port;
     out->unavailable = false;
     adev->active_output = out;
+    /* Load seen before standby says little about now, start again at full quality */
+    proc_budget_reset(&out->budget);
     return 0;
 }
 
 static uint32_t out_get_sample_rate(const struct audio_stream *stream)
 {
     struct alsa_stream_out *out = (struct alsa_stream_out *)stream;
+    if (out->iec61937 != NULL) {
+        /* Rate of the coded audio, not of the bursts carrying it */
+        return PLAYBACK_CODEC_SAMPLING_RATE;
+    }
     return out->config.rate;
 }
 
@@ -254,6 +506,11 @@ static int out_set_sample_rate(struct audio_stream *stream, uint32_t rate)
 static size_t out_get_buffer_size(const struct audio_stream *stream)
 {
     ALOGV("out_get_buffer_size: %d", 4096);
+    struct alsa_stream_out* out = (struct alsa_stream_out*)stream;
+    if (out->iec61937 != NULL) {
+        /* Coded bytes: about one burst worth, the framer takes any amount */
+        return out->iec61937->burst_bytes;
+    }
 
     /* return the closest majoring multiple of 16 frames, as
      * audioflinger expects audio buffers to be a multiple of 16 frames */
@@ -273,7 +530,7 @@ static audio_format_t out_get_format(const struct audio_stream *stream)
 {
     ALOGV("out_get_format");
     struct alsa_stream_out *out = (struct alsa_stream_out *)stream;
-    return audio_format_from_pcm_format(out->config.format);
+    return out->format;
 }
 
 static int out_set_format(struct audio_stream *stream, audio_format_t format)
@@ -282,22 +539,102 @@ static int out_set_format(struct audio_stream *stream, audio_format_t format)
     return -ENOSYS;
 }
 
-static int do_output_standby(struct alsa_stream_out *out)
+/* Mark the IEC958 channel status of the HDMI output as non-audio (AES0 bit 1) while a
+ * passthrough stream plays, so the sink decodes the bursts instead of playing them as PCM.
+ * Clearing it restores the byte saved when it was set.
+ * must be called with hw device and output stream mutexes locked */
+static void out_set_iec958_non_audio(struct alsa_stream_out* out, bool non_audio)
+{
+    if (non_audio == out->iec958_non_audio) {
+        return;
+    }
+    struct mixer_ctl* ctl = mixer_get_ctl_by_name(out->dev->mixer, IEC958_STATUS_CTL);
+    uint8_t status[IEC958_STATUS_BYTES];
+    if ((ctl == NULL) || (mixer_ctl_get_array(ctl, status, sizeof(status)) != 0)) {
+        ALOGW("%s: cannot read %s", __func__, IEC958_STATUS_CTL);
+        out->iec958_non_audio = false;
+        return;
+    }
+    if (non_audio) {
+        out->iec958_saved_aes0 = status[0];
+        status[0] |= IEC958_AES0_NONAUDIO;
+    } else {
+        status[0] = out->iec958_saved_aes0;
+    }
+    if (mixer_ctl_set_array(ctl, status, sizeof(status)) != 0) {
+        ALOGW("%s: cannot write %s", __func__, IEC958_STATUS_CTL);
+        non_audio = false;
+    }
+    out->iec958_non_audio = non_audio;
+}
+
+/* Put the stream in standby. Unless 'close_pcm' is set or warm standby is disabled, the PCM is
+ * only stopped and prepared again, and closed later by out_close_expired().
+ * must be called with hw device and output stream mutexes locked */
+static int do_output_standby(struct alsa_stream_out *out, bool close_pcm)
 {
     struct alsa_audio_device *adev = out->dev;
 
-    fir_reset(out->speaker_eq);
+    eq_filter_reset(out->speaker_eq);
 
     if (!out->standby) {
-        pcm_close(out->pcm);
-        out->pcm = NULL;
         adev->active_output = NULL;
         out->standby = 1;
+        if (!close_pcm && (adev->warm_standby_ms > 0) && (pcm_stop(out->pcm) == 0) &&
+            (pcm_prepare(out->pcm) == 0)) {
+            standby_timer_arm(adev->standby_timer, &out->close_timer, adev->warm_standby_ms);
+        } else {
+            close_pcm = true;
+        }
+    }
+    if (close_pcm && (out->pcm != NULL)) {
+        pcm_close(out->pcm);
+        out->pcm = NULL;
+        /* Only a closed PCM ends the reference, warm standby resumes it without a flush */
+        if (out->iec61937 == NULL) {
+            aec_set_spk_running(adev->aec, false);
+        }
+    }
+    /* A switch in progress is dropped, resume opens the current port directly */
+    if (out->pending_pcm != NULL) {
+        pcm_close(out->pending_pcm);
+        out->pending_pcm = NULL;
+    }
+    if (out->retired_pcm != NULL) {
+        pcm_close(out->retired_pcm);
+        out->retired_pcm = NULL;
+    }
+    out->reroute_fading = false;
+    /* Staged frames were never queued, like whatever the stopped PCM still held */
+    out->stage_frames = 0;
+    if (out->iec61937 != NULL) {
+        /* Resume starts on the next sync word */
+        iec61937_reset(out->iec61937);
+        out_set_iec958_non_audio(out, false);
     }
-    aec_set_spk_running(adev->aec, false);
     return 0;
 }
 
+/* close_timer callback: the stream has stayed in standby for the whole warm standby period */
+static void out_close_expired(void* context)
+{
+    struct alsa_stream_out* out = (struct alsa_stream_out*)context;
+
+    pthread_mutex_lock(&out->dev->lock);
+    pthread_mutex_lock(&out->lock);
+    if (out->standby && (out->pcm != NULL) &&
+        (proc_budget_now_nsec() >= out->close_timer.deadline_nsec)) {
+        ALOGV("%s: closing idle output PCM", __func__);
+        pcm_close(out->pcm);
+        out->pcm = NULL;
+        if (out->iec61937 == NULL) {
+            aec_set_spk_running(out->dev->aec, false);
+        }
+    }
+    pthread_mutex_unlock(&out->lock);
+    pthread_mutex_unlock(&out->dev->lock);
+}
+
 static int out_standby(struct audio_stream *stream)
 {
     ALOGV("out_standby");
@@ -306,7 +643,7 @@ static int out_standby(struct audio_stream *stream)
 
     pthread_mutex_lock(&out->dev->lock);
     pthread_mutex_lock(&out->lock);
-    status = do_output_standby(out);
+    status = do_output_standby(out, false /* close_pcm */);
     pthread_mutex_unlock(&out->lock);
     pthread_mutex_unlock(&out->dev->lock);
     return status;
@@ -315,6 +652,8 @@ static int out_standby(struct audio_stream *stream)
 static int out_dump(const struct audio_stream *stream, int fd)
 {
     ALOGV("out_dump");
+    struct alsa_stream_out* out = (struct alsa_stream_out*)stream;
+    stream_stats_dump(&out->stats, fd, 2, "EQ and gain", "Write to presentation");
     return 0;
 }
 
@@ -326,6 +665,7 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
     struct str_parms *parms;
     char value[32];
     int ret, val = 0;
+    int status = 0;
 
     parms = str_parms_create_str(kvpairs);
 
@@ -334,16 +674,38 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
         val = atoi(value);
         pthread_mutex_lock(&adev->lock);
         pthread_mutex_lock(&out->lock);
-        if (((out->devices & AUDIO_DEVICE_OUT_ALL) != val) && (val != 0)) {
+        if ((out->iec61937 != NULL) && (val != 0) &&
+            (get_audio_output_port(val) != PORT_HDMI)) {
+            /* Only an HDMI sink can decode the bursts */
+            ALOGW("%s: passthrough stream cannot move to devices %#x", __func__, val);
+            status = -EINVAL;
+        } else if (((out->devices & AUDIO_DEVICE_OUT_ALL) != val) && (val != 0)) {
             out->devices &= ~AUDIO_DEVICE_OUT_ALL;
             out->devices |= val;
+            /* Switch in the background, see out_reroute_work() and out_reroute_step() */
+            out->reroute_port = get_audio_output_port(out->devices);
+            if ((out->pending_pcm != NULL) && (out->pending_port != out->reroute_port)) {
+                /* Moved on before the last switch happened */
+                pcm_close(out->pending_pcm);
+                out->pending_pcm = NULL;
+                out->reroute_fading = false;
+            }
+            standby_timer_arm(adev->standby_timer, &out->reroute_timer, 0);
         }
         pthread_mutex_unlock(&out->lock);
         pthread_mutex_unlock(&adev->lock);
     }
 
+    if (str_parms_has_key(parms, AUDIO_PARAMETER_SPEAKER_EQ_RELOAD)) {
+        if (get_audio_output_port(out->devices) == PORT_INTERNAL_SPEAKER) {
+            status = out_reload_eq(out);
+        } else {
+            status = -ENOSYS;
+        }
+    }
+
     str_parms_destroy(parms);
-    return 0;
+    return status;
 }
 
 static char * out_get_parameters(const struct audio_stream *stream, const char *keys)
@@ -356,20 +718,150 @@ static uint32_t out_get_latency(const struct audio_stream_out *stream)
 {
     ALOGV("out_get_latency");
     struct alsa_stream_out *out = (struct alsa_stream_out *)stream;
-    return (PLAYBACK_PERIOD_SIZE * PLAYBACK_PERIOD_COUNT * 1000) / out->config.rate;
+    return (out->config.period_size * out->config.period_count * 1000) / out->config.rate;
 }
 
 static int out_set_volume(struct audio_stream_out *stream, float left,
         float right)
 {
     ALOGV("out_set_volume: Left:%f Right:%f", left, right);
-    return -ENOSYS;
+    struct alsa_stream_out *out = (struct alsa_stream_out *)stream;
+    if (out->iec61937 != NULL) {
+        /* Coded audio cannot be scaled, the sink applies its own volume */
+        return -ENOSYS;
+    }
+    if (left < 0.0f || left > 1.0f || right < 0.0f || right > 1.0f) {
+        return -EINVAL;
+    }
+    /* A single gain is applied to all channels: balance is left to the framework. */
+    pthread_mutex_lock(&out->lock);
+    out->volume = (left + right) / 2;
+    pthread_mutex_unlock(&out->lock);
+    return 0;
+}
+
+/* Process 'frames' frames of a 16-bit stream in place through 'eq' (NULL for no EQ). With
+ * 'crossfade' set, fade from 'previous' (NULL for no EQ) to 'eq' over the chunk. */
+static void out_process_i16(struct alsa_stream_out* out, int16_t* buffer, size_t frames,
+                            const gain_segment_t* gain, eq_filter_t* eq, bool crossfade,
+                            eq_filter_t* previous) {
+    size_t samples = frames * out->config.channels;
+    if (crossfade) {
+        gain_segment_t fade_in, fade_out;
+        gain_crossfade_segments(frames, &fade_in, &fade_out);
+        int16_t* scratch = (int16_t*)out->eq_scratch;
+        if (previous != NULL) {
+            eq_filter_process_interleaved(previous, buffer, scratch, frames, &fade_out);
+        } else {
+            memcpy(scratch, buffer, samples * sizeof(int16_t));
+            gain_apply_i16(scratch, out->config.channels, frames, &fade_out);
+        }
+        if (eq != NULL) {
+            eq_filter_process_interleaved(eq, buffer, buffer, frames, &fade_in);
+        } else {
+            gain_apply_i16(buffer, out->config.channels, frames, &fade_in);
+        }
+        pcm_accumulate_i16(buffer, scratch, samples);
+        gain_apply_i16(buffer, out->config.channels, frames, gain);
+    } else if (eq != NULL) {
+        eq_filter_process_interleaved(eq, buffer, buffer, frames, gain);
+    } else {
+        gain_apply_i16(buffer, out->config.channels, frames, gain);
+    }
+}
+
+/* Process 'frames' frames of a non 16-bit stream: convert to Q31, run 'eq' and 'gain' at that
+ * precision and emit the codec samples and 16-bit echo reference (in out->ref_buf) in one pass.
+ * 'eq', 'crossfade' and 'previous' are as for out_process_i16().
+ * Returns the buffer to write to the PCM. */
+static const void* out_process_high_res(struct alsa_stream_out* out, const void* buffer,
+                                        size_t frames, const gain_segment_t* gain,
+                                        eq_filter_t* eq, bool crossfade, eq_filter_t* previous) {
+    size_t samples = frames * out->config.channels;
+    if (crossfade) {
+        gain_segment_t fade_in, fade_out;
+        gain_crossfade_segments(frames, &fade_in, &fade_out);
+        int32_t* scratch = (int32_t*)out->eq_scratch;
+        int32_t* input = (eq != NULL) ? eq_filter_get_input_q31(eq) : out->proc_buf;
+        pcm_convert_to_i32(input, buffer, out->format, samples);
+        if (previous != NULL) {
+            memcpy(eq_filter_get_input_q31(previous), input, samples * sizeof(int32_t));
+            eq_filter_process_interleaved_q31(previous, scratch, frames, &fade_out);
+        } else {
+            memcpy(scratch, input, samples * sizeof(int32_t));
+            gain_apply_q31(scratch, out->config.channels, frames, &fade_out);
+        }
+        if (eq != NULL) {
+            eq_filter_process_interleaved_q31(eq, out->proc_buf, frames, &fade_in);
+        } else {
+            gain_apply_q31(out->proc_buf, out->config.channels, frames, &fade_in);
+        }
+        pcm_accumulate_i32(out->proc_buf, scratch, samples);
+        gain_apply_q31(out->proc_buf, out->config.channels, frames, gain);
+    } else if (eq != NULL) {
+        /* Converted input goes straight into the filter's own input buffer */
+        pcm_convert_to_i32(eq_filter_get_input_q31(eq), buffer, out->format, samples);
+        eq_filter_process_interleaved_q31(eq, out->proc_buf, frames, gain);
+    } else if (gain_segment_is_silent(gain)) {
+        memset(out->proc_buf, 0, samples * sizeof(int32_t));
+    } else {
+        pcm_convert_to_i32(out->proc_buf, buffer, out->format, samples);
+        gain_apply_q31(out->proc_buf, out->config.channels, frames, gain);
+    }
+    if (out->config.format == PCM_FORMAT_S32_LE) {
+        pcm_convert_emit_from_i32(out->proc_buf, PCM_FORMAT_S32_LE, out->ref_buf, out->proc_buf,
+                                  samples);
+        return out->proc_buf;
+    }
+    pcm_convert_emit_from_i32(out->ref_buf, PCM_FORMAT_S16_LE, out->ref_buf, out->proc_buf,
+                              samples);
+    return out->ref_buf;
+}
+
+/* Passthrough: cut the coded stream into IEC 61937 bursts and write each one as a period.
+ * There is nothing to process and no echo reference, the sink decodes and renders the audio. */
+static int out_write_passthrough(struct alsa_stream_out* out, const void* buffer, size_t bytes)
+{
+    const uint8_t* src = (const uint8_t*)buffer;
+    const size_t burst_bytes = out->iec61937->burst_bytes;
+    int ret = 0;
+    while ((bytes > 0) && (ret == 0)) {
+        const uint8_t* burst;
+        size_t used = iec61937_feed(out->iec61937, src, bytes, &burst);
+        src += used;
+        bytes -= used;
+        if (burst == NULL) {
+            continue;
+        }
+        uint64_t start_nsec = proc_budget_now_nsec();
+        ret = pcm_write(out->pcm, burst, burst_bytes);
+        if (ret != 0) {
+            ret = out_recover_write(out, ret, burst, burst_bytes);
+        }
+        uint64_t now_nsec = proc_budget_now_nsec();
+        stream_stats_add_io(&out->stats, now_nsec - start_nsec, out->config.period_size,
+                            ret != 0);
+        if (ret != 0) {
+            break;
+        }
+        /* Position is in decoded frames, at the rate reported by out_get_sample_rate() */
+        out->frames_written += IEC61937_AUDIO_FRAMES;
+        struct aec_info info;
+        if (get_pcm_timestamp(out->pcm, out->config.rate, &info, true /*isOutput*/) == 0) {
+            uint64_t presentation_nsec = audio_utils_ns_from_timespec(&info.timestamp);
+            if (presentation_nsec > now_nsec) {
+                stream_stats_add_latency(&out->stats, presentation_nsec - now_nsec);
+            }
+            out->timestamp = info.timestamp;
+        }
+    }
+    return ret;
 }
 
 static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
         size_t bytes)
 {
-    int ret;
+    int ret = 0;
     struct alsa_stream_out *out = (struct alsa_stream_out *)stream;
     struct alsa_audio_device *adev = out->dev;
     size_t frame_size = audio_stream_out_frame_size(stream);
@@ -383,42 +875,118 @@ static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
      */
     pthread_mutex_lock(&adev->lock);
     pthread_mutex_lock(&out->lock);
+    if (out->reopen_pcm) {
+        do_output_standby(out, true /* close_pcm */);
+        out->reopen_pcm = false;
+    }
     if (out->standby) {
+        if (out->iec61937 != NULL) {
+            /* Before the first burst reaches the sink */
+            out_set_iec958_non_audio(out, true);
+        }
         ret = start_output_stream(out);
         if (ret != 0) {
             pthread_mutex_unlock(&adev->lock);
             goto exit;
         }
         out->standby = 0;
-        aec_set_spk_running(adev->aec, true);
+        if (out->iec61937 == NULL) {
+            aec_set_spk_running(adev->aec, true);
+        }
     }
+    int32_t target_gain =
+            adev->master_mute ? 0 : gain_from_float(adev->master_volume * out->volume);
 
     pthread_mutex_unlock(&adev->lock);
 
-    if (out->speaker_eq != NULL) {
-        fir_process_interleaved(out->speaker_eq, (int16_t*)buffer, (int16_t*)buffer, out_frames);
+    /* Everything below runs on preallocated, locked buffers */
+    rt_hot_path_enter();
+    if (out->iec61937 != NULL) {
+        ret = out_write_passthrough(out, buffer, bytes);
+        rt_hot_path_leave();
+        goto exit;
     }
+    const int8_t* src = (const int8_t*)buffer;
+    size_t frames_left = out_frames;
+    while ((frames_left > 0) && (ret == 0)) {
+        /* Processing buffers and EQ history are sized for process_frames, a period. Chunks end
+         * on period boundaries so that staged short writes complete a period exactly. */
+        size_t frames = out->process_frames - out->stage_frames;
+        if (frames > frames_left) {
+            frames = frames_left;
+        }
+        const void* codec_buffer = src;
+        const int16_t* ref_buffer = (const int16_t*)src;
+        /* The speaker EQ only applies on the speaker port, it follows the stream when rerouted */
+        eq_filter_t* retired_eq = NULL;
+        eq_filter_t* previous_eq = (out->eq_bypassed || (out->pcm_port != PORT_INTERNAL_SPEAKER))
+                                           ? NULL
+                                           : out->speaker_eq;
+        bool rerouted = out_reroute_step(out);
+        /* After a switch, the new port may take another sample format */
+        size_t codec_frame_size =
+                out->config.channels * (pcm_format_to_bits(out->config.format) >> 3);
+        gain_segment_t gain;
+        gain_ramp_next(&out->gain, out->reroute_fading ? 0 : target_gain, frames, &gain);
+        bool adopted = out_adopt_pending_eq(out, &retired_eq);
+        bool crossfade = out_apply_budget(out) || adopted || rerouted;
+        eq_filter_t* eq = (out->eq_bypassed || (out->pcm_port != PORT_INTERNAL_SPEAKER))
+                                  ? NULL
+                                  : out->speaker_eq;
+
+        uint64_t start_nsec = proc_budget_now_nsec();
+        if (out->format == AUDIO_FORMAT_PCM_16_BIT) {
+            out_process_i16(out, (int16_t*)src, frames, &gain, eq, crossfade, previous_eq);
+        } else {
+            codec_buffer =
+                    out_process_high_res(out, src, frames, &gain, eq, crossfade, previous_eq);
+            ref_buffer = out->ref_buf;
+        }
+        uint64_t end_nsec = proc_budget_now_nsec();
+        proc_budget_update(&out->budget, end_nsec - start_nsec, frames);
+        stream_stats_add_dsp(&out->stats, end_nsec - start_nsec);
+        if (adopted) {
+            out_retire_eq(out, retired_eq);
+        }
 
-    ret = pcm_write(out->pcm, buffer, out_frames * frame_size);
-    if (ret == 0) {
-        out->frames_written += out_frames;
-
-        struct aec_info info;
-        get_pcm_timestamp(out->pcm, out->config.rate, &info, true /*isOutput*/);
-        out->timestamp = info.timestamp;
-        info.bytes = out_frames * frame_size;
-        int aec_ret = write_to_reference_fifo(adev->aec, (void *)buffer, &info);
-        if (aec_ret) {
-            ALOGE("AEC: Write to speaker loopback FIFO failed!");
+        if ((out->stage_frames == 0) && (frames == out->process_frames)) {
+            ret = out_write_period(out, codec_buffer, ref_buffer);
+        } else {
+            /* Short write: collect processed frames until there is a whole period */
+            size_t ref_frame_size = out->config.channels * sizeof(int16_t);
+            memcpy(&out->stage_buf[out->stage_frames * codec_frame_size], codec_buffer,
+                   frames * codec_frame_size);
+            if (out->stage_ref != NULL) {
+                memcpy(&out->stage_ref[out->stage_frames * ref_frame_size], ref_buffer,
+                       frames * ref_frame_size);
+            }
+            out->stage_frames += frames;
+            if (out->stage_frames == out->process_frames) {
+                out->stage_frames = 0;
+                ret = out_write_period(out, out->stage_buf,
+                                       (out->stage_ref != NULL) ? out->stage_ref
+                                                                : out->stage_buf);
+            }
         }
+        src += frames * frame_size;
+        frames_left -= frames;
     }
 
+    rt_hot_path_leave();
+
 exit:
     pthread_mutex_unlock(&out->lock);
 
     if (ret != 0) {
-        usleep((int64_t)bytes * 1000000 / audio_stream_out_frame_size(stream) /
-                out_get_sample_rate(&stream->common));
+        /* Xruns were recovered in place, this is a device failure: keep the caller paced
+         * until the PCM is reopened. */
+        if (out->iec61937 != NULL) {
+            /* Coded bytes have no fixed duration: pace by one burst */
+            usleep((int64_t)IEC61937_AUDIO_FRAMES * 1000000 / PLAYBACK_CODEC_SAMPLING_RATE);
+        } else {
+            usleep((int64_t)bytes * 1000000 / audio_stream_out_frame_size(stream) /
+                    out_get_sample_rate(&stream->common));
+        }
     }
 
     return bytes;
@@ -470,47 +1038,30 @@ static int out_get_next_write_timestamp(const struct audio_stream_out *stream,
 
 /** audio_stream_in implementation **/
 
-/* must be called with hw device and input stream mutexes locked */
-static int start_input_stream(struct alsa_stream_in *in)
-{
-    struct alsa_audio_device *adev = in->dev;
-    in->unavailable = true;
-    unsigned int pcm_retry_count = PCM_OPEN_RETRIES;
-
-    while (1) {
-        in->pcm = pcm_open(CARD_IN, PORT_BUILTIN_MIC, PCM_IN | PCM_MONOTONIC, &in->config);
-        if ((in->pcm != NULL) && pcm_is_ready(in->pcm)) {
-            break;
-        } else {
-            ALOGE("cannot open pcm_in driver: %s", pcm_get_error(in->pcm));
-            if (in->pcm != NULL) {
-                pcm_close(in->pcm);
-                in->pcm = NULL;
-            }
-            if (--pcm_retry_count == 0) {
-                ALOGE("Failed to open pcm_in after %d tries", PCM_OPEN_RETRIES);
-                return -ENODEV;
-            }
-            usleep(PCM_OPEN_WAIT_TIME_MS * 1000);
-        }
-    }
-    in->unavailable = false;
-    adev->active_input = in;
-    return 0;
-}
-
-static void get_input_characteristics(const struct alsa_stream_in* in,
+static void get_input_characteristics(const struct alsa_audio_device* adev,
+                                      const struct alsa_stream_in* in,
                                       struct audio_microphone_characteristic_t* mic_data,
                                       size_t* mic_count) {
     const struct audio_microphone_characteristic_t* chars = &kBuiltinMicChars;
-    *mic_count = 1;
+    bool beamforming = (adev->capture_hub->beamformer != NULL);
+    *mic_count = beamforming ? CAPTURE_MIC_ARRAY_CHANNELS : 1;
     if ((in != NULL) && in->source == AUDIO_SOURCE_ECHO_REFERENCE) {
         *mic_count = in->config.channels;
         chars = &kEchoReferenceChars;
+        beamforming = false;
     }
     for (size_t ch = 0; ch < (*mic_count); ch++) {
         memcpy(&mic_data[ch], chars, sizeof(struct audio_microphone_characteristic_t));
         mic_data[ch].index_in_the_group = ch;
+        if (beamforming) {
+            /* Every mic of the array contributes to the one beamformed channel */
+            snprintf(mic_data[ch].device_id, sizeof(mic_data[ch].device_id), "%s_%zu",
+                     chars->device_id, ch);
+            mic_data[ch].geometric_location = kMicArrayLocations[ch];
+            if (in != NULL) {
+                mic_data[ch].channel_mapping[0] = AUDIO_MICROPHONE_CHANNEL_MAPPING_PROCESSED;
+            }
+        }
     }
 }
 
@@ -547,8 +1098,8 @@ static audio_channel_mask_t in_get_channels(const struct audio_stream *stream)
 static audio_format_t in_get_format(const struct audio_stream *stream)
 {
     struct alsa_stream_in *in = (struct alsa_stream_in *)stream;
-    ALOGV("in_get_format: %d", in->config.format);
-    return audio_format_from_pcm_format(in->config.format);
+    ALOGV("in_get_format: %d", in->format);
+    return in->format;
 }
 
 static int in_set_format(struct audio_stream *stream, audio_format_t format)
@@ -579,7 +1130,7 @@ static int in_get_active_microphones(const struct audio_stream_in* stream,
     }
     struct alsa_stream_in* in = (struct alsa_stream_in*)stream;
     struct audio_hw_device* dev = (struct audio_hw_device*)in->dev;
-    get_input_characteristics(in, mic_array, mic_count);
+    get_input_characteristics(in->dev, in, mic_array, mic_count);
     bool mic_muted = false;
     adev_get_mic_mute(dev, &mic_muted);
     if (mic_muted && (in->source != AUDIO_SOURCE_ECHO_REFERENCE)) {
@@ -593,9 +1144,7 @@ static int do_input_standby(struct alsa_stream_in *in)
     struct alsa_audio_device *adev = in->dev;
 
     if (!in->standby) {
-        pcm_close(in->pcm);
-        in->pcm = NULL;
-        adev->active_input = NULL;
+        capture_hub_detach(adev->capture_hub, &in->hub_reader);
         in->standby = true;
     }
     return 0;
@@ -619,7 +1168,7 @@ static int in_dump(const struct audio_stream *stream, int fd)
     struct alsa_stream_in* in = (struct alsa_stream_in*)stream;
     struct audio_microphone_characteristic_t mic_array[AUDIO_MICROPHONE_MAX_COUNT];
     size_t mic_count;
-    get_input_characteristics(in, mic_array, &mic_count);
+    get_input_characteristics(in->dev, in, mic_array, &mic_count);
 
     dprintf(fd, "  %s count: %zd\n",
             (in->source == AUDIO_SOURCE_ECHO_REFERENCE) ? "Channel" : "Microphone", mic_count);
@@ -631,11 +1180,35 @@ static int in_dump(const struct audio_stream *stream, int fd)
         dprintf(fd, "    Sensitivity (dB): %.2f\n", mic_array[idx].sensitivity);
     }
 
+    if (in->source == AUDIO_SOURCE_ECHO_REFERENCE) {
+        stream_stats_dump(&in->stats, fd, 2, NULL, NULL);
+    } else {
+        stream_stats_dump(&in->stats, fd, 2, NULL, "Capture to delivery");
+        dprintf(fd, "  Capture thread (shared by all input streams):\n");
+        capture_hub_dump(in->dev->capture_hub, fd, 4);
+    }
+
     return 0;
 }
 
 static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
 {
+    struct alsa_stream_in* in = (struct alsa_stream_in*)stream;
+    struct str_parms* parms = str_parms_create_str(kvpairs);
+    int val = 0;
+
+    if (str_parms_get_int(parms, AUDIO_PARAMETER_CAPTURE_REWIND_MS, &val) >= 0) {
+        pthread_mutex_lock(&in->lock);
+        if (in->source == AUDIO_SOURCE_ECHO_REFERENCE) {
+            ALOGW("%s: rewind not supported on echo reference", __func__);
+        } else {
+            /* Only takes effect when the stream leaves standby */
+            in->rewind_ms = (val > 0) ? val : 0;
+        }
+        pthread_mutex_unlock(&in->lock);
+    }
+
+    str_parms_destroy(parms);
     return 0;
 }
 
@@ -650,6 +1223,48 @@ static int in_set_gain(struct audio_stream_in *stream, float gain)
     return 0;
 }
 
+/* Deliver 'frames' frames of echo reference silence at the nominal rate. Each buffer's timestamp
+ * and wake-up time are derived from the frame count since a base time, not accumulated, so
+ * neither drifts from CLOCK_MONOTONIC and an oversleep is absorbed by the next buffer.
+ * 'duration_nsec' is the length of 'frames'. */
+static void in_pace_echo_reference(struct alsa_stream_in* in, size_t frames, uint32_t rate,
+                                   uint64_t duration_nsec) {
+    uint64_t now_nsec = proc_budget_now_nsec();
+    if (in->pace_base_nsec == 0) {
+        /* Continue the cadence of the real reference, if there was one and it ended just now */
+        uint64_t base_nsec = (in->timestamp_nsec != 0) ? in->timestamp_nsec + duration_nsec : 0;
+        if ((base_nsec + duration_nsec < now_nsec) || (base_nsec > now_nsec + duration_nsec)) {
+            base_nsec = now_nsec;
+        }
+        in->pace_base_nsec = base_nsec;
+        in->pace_frames = 0;
+    }
+
+    /* Move the base in whole seconds so the frame count stays small, exactly */
+    in->pace_base_nsec += in->pace_frames / rate * NANOS_PER_SECOND;
+    in->pace_frames %= rate;
+    uint64_t start_nsec = in->pace_base_nsec + in->pace_frames * NANOS_PER_SECOND / rate;
+    uint64_t deadline_nsec = start_nsec + duration_nsec;
+    if (deadline_nsec + duration_nsec < now_nsec) {
+        /* The reader stalled for more than a buffer: restart the cadence instead of bursting */
+        in->pace_base_nsec = now_nsec;
+        in->pace_frames = 0;
+        start_nsec = now_nsec;
+        deadline_nsec = now_nsec + duration_nsec;
+    }
+    in->timestamp_nsec = start_nsec;
+    in->pace_frames += frames;
+
+    struct timespec deadline = {
+            .tv_sec = deadline_nsec / NANOS_PER_SECOND,
+            .tv_nsec = deadline_nsec % NANOS_PER_SECOND,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+    /* Pacing silence stands in for the reference read */
+    stream_stats_add_io(&in->stats, proc_budget_now_nsec() - now_nsec, frames, false);
+}
+
 static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
         size_t bytes)
 {
@@ -666,24 +1281,20 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
     if (in->source == AUDIO_SOURCE_ECHO_REFERENCE) {
         struct aec_info info;
         info.bytes = bytes;
+        rt_hot_path_enter();
 
-        const uint64_t time_increment_nsec = (uint64_t)bytes * NANOS_PER_SECOND /
-                                             audio_stream_in_frame_size(stream) /
-                                             in_get_sample_rate(&stream->common);
+        const uint32_t rate = in_get_sample_rate(&stream->common);
+        const uint64_t time_increment_nsec = (uint64_t)in_frames * NANOS_PER_SECOND / rate;
         if (!aec_get_spk_running(adev->aec)) {
-            if (in->timestamp_nsec == 0) {
-                struct timespec now;
-                clock_gettime(CLOCK_MONOTONIC, &now);
-                const uint64_t timestamp_nsec = audio_utils_ns_from_timespec(&now);
-                in->timestamp_nsec = timestamp_nsec;
-            } else {
-                in->timestamp_nsec += time_increment_nsec;
-            }
             memset(buffer, 0, bytes);
-            const uint64_t time_increment_usec = time_increment_nsec / 1000;
-            usleep(time_increment_usec);
+            in_pace_echo_reference(in, in_frames, rate, time_increment_nsec);
         } else {
+            /* Real reference from now on: pacing restarts from its timestamps when it stops */
+            in->pace_base_nsec = 0;
+            uint64_t start_nsec = proc_budget_now_nsec();
             int ref_ret = get_reference_samples(adev->aec, buffer, &info);
+            stream_stats_add_io(&in->stats, proc_budget_now_nsec() - start_nsec, in_frames,
+                                ref_ret != 0);
             if ((ref_ret) || (info.timestamp_usec == 0)) {
                 memset(buffer, 0, bytes);
                 in->timestamp_nsec += time_increment_nsec;
@@ -692,6 +1303,8 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
             }
         }
         in->frames_read += in_frames;
+        in->timestamp_frames = in->frames_read;
+        rt_hot_path_leave();
 
 #if DEBUG_AEC
         FILE* fp_ref = fopen("/data/local/traces/aec_ref.pcm", "a+");
@@ -714,6 +1327,9 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
 
     /* Microphone input stream read */
 
+    bool mic_muted = false;
+    adev_get_mic_mute((struct audio_hw_device*)adev, &mic_muted);
+
     /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
      * on the input stream mutex - e.g. executing select_mode() while holding the hw device
      * mutex
@@ -721,10 +1337,11 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
     pthread_mutex_lock(&in->lock);
     pthread_mutex_lock(&adev->lock);
     if (in->standby) {
-        ret = start_input_stream(in);
+        ret = capture_hub_attach(adev->capture_hub, &in->hub_reader,
+                                 (size_t)in->rewind_ms * in->config.rate / 1000);
         if (ret != 0) {
             pthread_mutex_unlock(&adev->lock);
-            ALOGE("start_input_stream failed with code %d", ret);
+            ALOGE("capture_hub_attach failed with code %d", ret);
             goto exit;
         }
         in->standby = false;
@@ -732,39 +1349,36 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
 
     pthread_mutex_unlock(&adev->lock);
 
-    ret = pcm_read(in->pcm, buffer, in_frames * frame_size);
-    struct aec_info info;
-    get_pcm_timestamp(in->pcm, in->config.rate, &info, false /*isOutput*/);
+    rt_hot_path_enter();
+    /* AEC already ran on the shared capture thread, conversion to the stream format and
+     * muting are applied while copying out of the hub. */
+    uint64_t timestamp_nsec = 0;
+    uint64_t start_nsec = proc_budget_now_nsec();
+    ret = capture_hub_read(adev->capture_hub, &in->hub_reader, buffer, in->format, in_frames,
+                           mic_muted, &timestamp_nsec);
+    uint64_t now_nsec = proc_budget_now_nsec();
+    stream_stats_add_io(&in->stats, now_nsec - start_nsec, in_frames, ret != 0);
+    if ((ret == 0) && (now_nsec > timestamp_nsec)) {
+        stream_stats_add_latency(&in->stats, now_nsec - timestamp_nsec);
+    }
     if (ret == 0) {
+        /* The hub times the first frame read */
+        in->timestamp_frames = in->frames_read;
+        in->timestamp_nsec = timestamp_nsec;
         in->frames_read += in_frames;
-        in->timestamp_nsec = audio_utils_ns_from_timespec(&info.timestamp);
     }
     else {
-        ALOGE("pcm_read failed with code %d", ret);
+        ALOGE("capture_hub_read failed with code %d", ret);
     }
+    rt_hot_path_leave();
 
 exit:
     pthread_mutex_unlock(&in->lock);
 
-    bool mic_muted = false;
-    adev_get_mic_mute((struct audio_hw_device*)adev, &mic_muted);
-    if (mic_muted) {
-        memset(buffer, 0, bytes);
-    }
-
     if (ret != 0) {
+        memset(buffer, 0, bytes);
         usleep((int64_t)bytes * 1000000 / audio_stream_in_frame_size(stream) /
                 in_get_sample_rate(&stream->common));
-    } else {
-        /* Process AEC if available */
-        /* TODO move to a separate thread */
-        if (!mic_muted) {
-            info.bytes = bytes;
-            int aec_ret = process_aec(adev->aec, buffer, &info);
-            if (aec_ret) {
-                ALOGE("process_aec returned error code %d", aec_ret);
-            }
-        }
     }
 
 #if DEBUG_AEC && !defined(AEC_HAL)
@@ -794,7 +1408,7 @@ static int in_get_capture_position(const struct audio_stream_in* stream, int64_t
     }
     struct alsa_stream_in* in = (struct alsa_stream_in*)stream;
 
-    *frames = in->frames_read;
+    *frames = in->timestamp_frames;
     *time = in->timestamp_nsec;
     ALOGV("%s: source: %d, timestamp (nsec): %" PRIu64, __func__, in->source, *time);
 
@@ -803,7 +1417,12 @@ static int in_get_capture_position(const struct audio_stream_in* stream, int64_t
 
 static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream)
 {
-    return 0;
+    struct alsa_stream_in* in = (struct alsa_stream_in*)stream;
+    pthread_mutex_lock(&in->lock);
+    uint32_t frames_lost = in->hub_reader.frames_lost;
+    in->hub_reader.frames_lost = 0;
+    pthread_mutex_unlock(&in->lock);
+    return frames_lost;
 }
 
 static int in_add_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
@@ -816,6 +1435,30 @@ static int in_remove_audio_effect(const struct audio_stream *stream, effect_hand
     return 0;
 }
 
+/* Set up 'out' for IEC 61937 passthrough of the AC3 or E-AC3 stream described by 'config'. Bursts
+ * go out as 16-bit stereo periods of one burst each, on HDMI only. */
+static int out_init_passthrough(struct alsa_stream_out* out, int out_port,
+                                audio_output_flags_t flags, struct audio_config* config)
+{
+    if (!(flags & AUDIO_OUTPUT_FLAG_DIRECT) || (out_port != PORT_HDMI) ||
+        (config->sample_rate != PLAYBACK_CODEC_SAMPLING_RATE) ||
+        (audio_channel_count_from_out_mask(config->channel_mask) != CHANNEL_STEREO)) {
+        ALOGE("%s: format %#x needs a direct stereo %d Hz stream to HDMI", __func__,
+              config->format, PLAYBACK_CODEC_SAMPLING_RATE);
+        config->sample_rate = PLAYBACK_CODEC_SAMPLING_RATE;
+        config->channel_mask = audio_channel_out_mask_from_count(CHANNEL_STEREO);
+        return -EINVAL;
+    }
+    out->iec61937 = iec61937_init((config->format == AUDIO_FORMAT_E_AC3) ? IEC61937_EAC3
+                                                                        : IEC61937_AC3);
+    if (out->iec61937 == NULL) {
+        return -ENOMEM;
+    }
+    out->config.rate = out->iec61937->transport_rate;
+    out->config.period_size = out->iec61937->burst_bytes / (CHANNEL_STEREO * sizeof(int16_t));
+    return 0;
+}
+
 static int adev_open_output_stream(struct audio_hw_device *dev,
         audio_io_handle_t handle,
         audio_devices_t devices,
@@ -832,6 +1475,9 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     if (!params) {
         return -ENOSYS;
     }
+    /* High resolution streams keep 32 bits all the way to the codec when it can take them. */
+    bool codec_supports_s32 = pcm_params_format_test(params, PCM_FORMAT_S32_LE);
+    pcm_params_free(params);
 
     struct alsa_stream_out* out =
             (struct alsa_stream_out*)calloc(1, sizeof(struct alsa_stream_out));
@@ -863,31 +1509,90 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     out->config.format = PCM_FORMAT_S16_LE;
     out->config.period_size = PLAYBACK_PERIOD_SIZE;
     out->config.period_count = PLAYBACK_PERIOD_COUNT;
+    out->start_threshold_periods = PLAYBACK_PERIOD_START_THRESHOLD;
 
-    if (out->config.rate != config->sample_rate ||
+    if ((config->format == AUDIO_FORMAT_AC3) || (config->format == AUDIO_FORMAT_E_AC3)) {
+        if (out_init_passthrough(out, out_port, flags, config) != 0) {
+            goto error_1;
+        }
+    } else if (out->config.rate != config->sample_rate ||
            audio_channel_count_from_out_mask(config->channel_mask) != CHANNEL_STEREO ||
-               out->config.format !=  pcm_format_from_audio_format(config->format) ) {
+               !pcm_convert_to_i32_supported(config->format)) {
         config->sample_rate = out->config.rate;
-        config->format = audio_format_from_pcm_format(out->config.format);
+        config->format = AUDIO_FORMAT_PCM_16_BIT;
         config->channel_mask = audio_channel_out_mask_from_count(CHANNEL_STEREO);
         goto error_1;
     }
 
-    ALOGI("adev_open_output_stream selects channels=%d rate=%d format=%d, devices=%d",
-          out->config.channels, out->config.rate, out->config.format, devices);
+    out->format = config->format;
+    out->process_frames = out->config.period_size;
+    if ((out->iec61937 == NULL) && (out->format != AUDIO_FORMAT_PCM_16_BIT)) {
+        if (codec_supports_s32) {
+            out->config.format = PCM_FORMAT_S32_LE;
+        }
+        out->proc_buf = (int32_t*)rt_heap_calloc(out->process_frames * out->config.channels,
+                                                 sizeof(int32_t));
+        out->ref_buf = (int16_t*)rt_heap_calloc(out->process_frames * out->config.channels,
+                                                sizeof(int16_t));
+        if ((out->proc_buf == NULL) || (out->ref_buf == NULL)) {
+            ALOGE("%s: Failed to allocate processing buffers", __func__);
+            goto error_2;
+        }
+    }
+
+    ALOGI("adev_open_output_stream selects channels=%d rate=%d format=%#x (codec %d), devices=%d",
+          out->config.channels, out->config.rate, out->format, out->config.format, devices);
 
     out->dev = ladev;
     out->standby = 1;
+    standby_timer_entry_init(&out->close_timer, out_close_expired, out);
+    standby_timer_entry_init(&out->reroute_timer, out_reroute_work, out);
+    out->reroute_port = out_port;
     out->unavailable = false;
     out->devices = devices;
+    out->volume = 1.0f;
+    pthread_mutex_lock(&ladev->lock);
+    gain_ramp_init(&out->gain,
+                   ladev->master_mute ? 0 : gain_from_float(ladev->master_volume),
+                   PLAYBACK_GAIN_RAMP_MS * out->config.rate / 1000);
+    pthread_mutex_unlock(&ladev->lock);
+    proc_budget_init(&out->budget, "playback", out->config.rate, PLAYBACK_PROC_BUDGET_PERCENT);
+    stream_stats_init(&out->stats);
+    out->eq_bypassed = false;
 
     config->format = out_get_format(&out->stream.common);
     config->channel_mask = out_get_channels(&out->stream.common);
     config->sample_rate = out_get_sample_rate(&out->stream.common);
 
+    atomic_init(&out->pending_eq, NULL);
+    atomic_init(&out->retired_eq, NULL);
+    if (out->iec61937 != NULL) {
+        /* No EQ, gain or echo reference for coded audio */
+        *stream_out = &out->stream;
+        return 0;
+    }
+
+    out->eq_scratch = rt_heap_calloc(out->process_frames * out->config.channels, sizeof(int32_t));
+    if (out->eq_scratch == NULL) {
+        ALOGE("%s: Failed to allocate EQ scratch buffer", __func__);
+        goto error_2;
+    }
+    /* A 16-bit codec period doubles as the echo reference, a 32-bit one needs its own */
+    out->stage_buf = (int8_t*)rt_heap_calloc(
+            out->process_frames * out->config.channels,
+            (out->config.format == PCM_FORMAT_S32_LE) ? sizeof(int32_t) : sizeof(int16_t));
+    if (out->config.format == PCM_FORMAT_S32_LE) {
+        out->stage_ref = (int8_t*)rt_heap_calloc(out->process_frames * out->config.channels,
+                                                 sizeof(int16_t));
+    }
+    if ((out->stage_buf == NULL) ||
+        ((out->config.format == PCM_FORMAT_S32_LE) && (out->stage_ref == NULL))) {
+        ALOGE("%s: Failed to allocate staging buffers", __func__);
+        goto error_2;
+    }
     out->speaker_eq = NULL;
     if (out_port == PORT_INTERNAL_SPEAKER) {
-        out_set_eq(out);
+        out->speaker_eq = out_create_eq(out);
         if (out->speaker_eq == NULL) {
             ALOGE("%s: Failed to initialize speaker EQ", __func__);
         }
@@ -903,8 +1608,14 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     return 0;
 
 error_2:
-    fir_release(out->speaker_eq);
+    eq_filter_release(out->speaker_eq);
+    rt_heap_free(out->stage_ref);
+    rt_heap_free(out->stage_buf);
+    rt_heap_free(out->eq_scratch);
+    rt_heap_free(out->proc_buf);
+    rt_heap_free(out->ref_buf);
 error_1:
+    iec61937_release(out->iec61937);
     free(out);
     return -EINVAL;
 }
@@ -914,16 +1625,52 @@ static void adev_close_output_stream(struct audio_hw_device *dev,
 {
     ALOGV("adev_close_output_stream...");
     struct alsa_audio_device *adev = (struct alsa_audio_device *)dev;
-    destroy_aec_reference_config(adev->aec);
     struct alsa_stream_out* out = (struct alsa_stream_out*)stream;
-    fir_release(out->speaker_eq);
+    /* A PCM left open by warm standby or rerouting goes with the stream */
+    standby_timer_cancel(adev->standby_timer, &out->close_timer);
+    standby_timer_cancel(adev->standby_timer, &out->reroute_timer);
+    pthread_mutex_lock(&adev->lock);
+    pthread_mutex_lock(&out->lock);
+    do_output_standby(out, true /* close_pcm */);
+    pthread_mutex_unlock(&out->lock);
+    pthread_mutex_unlock(&adev->lock);
+    if (out->iec61937 == NULL) {
+        destroy_aec_reference_config(adev->aec);
+    }
+    iec61937_release(out->iec61937);
+    eq_filter_release(out->speaker_eq);
+    eq_filter_release(atomic_load(&out->pending_eq));
+    eq_filter_release(atomic_load(&out->retired_eq));
+    rt_heap_free(out->stage_ref);
+    rt_heap_free(out->stage_buf);
+    rt_heap_free(out->eq_scratch);
+    rt_heap_free(out->proc_buf);
+    rt_heap_free(out->ref_buf);
     free(stream);
 }
 
 static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
 {
     ALOGV("adev_set_parameters");
-    return -ENOSYS;
+    struct alsa_audio_device *adev = (struct alsa_audio_device *)dev;
+    struct str_parms *parms = str_parms_create_str(kvpairs);
+    char value[32];
+    int ret = -ENOSYS;
+
+    if (str_parms_get_str(parms, AUDIO_PARAMETER_CAPTURE_PREROLL, value, sizeof(value)) >= 0) {
+        bool enable = (strcmp(value, "on") == 0) || (strcmp(value, "1") == 0);
+        if (enable && (adev->capture_preroll_ms == 0)) {
+            ALOGW("%s: pre-roll disabled by %s", __func__, CAPTURE_PREROLL_MS_PROPERTY);
+            ret = -EINVAL;
+        } else {
+            pthread_mutex_lock(&adev->lock);
+            ret = capture_hub_set_background(adev->capture_hub, enable);
+            pthread_mutex_unlock(&adev->lock);
+        }
+    }
+
+    str_parms_destroy(parms);
+    return ret;
 }
 
 static char * adev_get_parameters(const struct audio_hw_device *dev,
@@ -940,7 +1687,7 @@ static int adev_get_microphones(const struct audio_hw_device* dev,
     if ((mic_array == NULL) || (mic_count == NULL)) {
         return -EINVAL;
     }
-    get_input_characteristics(NULL, mic_array, mic_count);
+    get_input_characteristics((const struct alsa_audio_device*)dev, NULL, mic_array, mic_count);
     return 0;
 }
 
@@ -959,25 +1706,45 @@ static int adev_set_voice_volume(struct audio_hw_device *dev, float volume)
 static int adev_set_master_volume(struct audio_hw_device *dev, float volume)
 {
     ALOGV("adev_set_master_volume: %f", volume);
-    return -ENOSYS;
+    struct alsa_audio_device *adev = (struct alsa_audio_device *)dev;
+    if (volume < 0.0f || volume > 1.0f) {
+        return -EINVAL;
+    }
+    /* Picked up and ramped to by the next out_write() */
+    pthread_mutex_lock(&adev->lock);
+    adev->master_volume = volume;
+    pthread_mutex_unlock(&adev->lock);
+    return 0;
 }
 
 static int adev_get_master_volume(struct audio_hw_device *dev, float *volume)
 {
+    struct alsa_audio_device *adev = (struct alsa_audio_device *)dev;
+    pthread_mutex_lock(&adev->lock);
+    *volume = adev->master_volume;
+    pthread_mutex_unlock(&adev->lock);
     ALOGV("adev_get_master_volume: %f", *volume);
-    return -ENOSYS;
+    return 0;
 }
 
 static int adev_set_master_mute(struct audio_hw_device *dev, bool muted)
 {
     ALOGV("adev_set_master_mute: %d", muted);
-    return -ENOSYS;
+    struct alsa_audio_device *adev = (struct alsa_audio_device *)dev;
+    pthread_mutex_lock(&adev->lock);
+    adev->master_mute = muted;
+    pthread_mutex_unlock(&adev->lock);
+    return 0;
 }
 
 static int adev_get_master_mute(struct audio_hw_device *dev, bool *muted)
 {
+    struct alsa_audio_device *adev = (struct alsa_audio_device *)dev;
+    pthread_mutex_lock(&adev->lock);
+    *muted = adev->master_mute;
+    pthread_mutex_unlock(&adev->lock);
     ALOGV("adev_get_master_mute: %d", *muted);
-    return -ENOSYS;
+    return 0;
 }
 
 static int adev_set_mode(struct audio_hw_device *dev, audio_mode_t mode)
@@ -992,6 +1759,7 @@ static int adev_set_mic_mute(struct audio_hw_device *dev, bool state)
     struct alsa_audio_device *adev = (struct alsa_audio_device *)dev;
     pthread_mutex_lock(&adev->lock);
     adev->mic_mute = state;
+    capture_hub_set_mic_mute(adev->capture_hub, state);
     pthread_mutex_unlock(&adev->lock);
     return 0;
 }
@@ -1059,32 +1827,42 @@ static int adev_open_input_stream(struct audio_hw_device* dev, audio_io_handle_t
                 CAPTURE_PERIOD_SIZE * PLAYBACK_CODEC_SAMPLING_RATE / CAPTURE_CODEC_SAMPLING_RATE;
     } else {
         in->config.rate = CAPTURE_CODEC_SAMPLING_RATE;
-        in->config.channels = CHANNEL_STEREO;
+        /* Stereo, or mono when the hub beamforms the mic array */
+        in->config.channels = ladev->capture_hub->channels;
         in->config.period_size = CAPTURE_PERIOD_SIZE;
     }
     in->config.format = PCM_FORMAT_S32_LE;
     in->config.period_count = CAPTURE_PERIOD_COUNT;
 
+    /* Mic streams are converted from the capture hub's S32 samples on delivery, so 16-bit and
+     * float are served natively. Echo reference is always S32. */
+    in->format = audio_format_from_pcm_format(in->config.format);
+    if ((source != AUDIO_SOURCE_ECHO_REFERENCE) && pcm_convert_from_i32_supported(config->format)) {
+        in->format = config->format;
+    }
+
     if (in->config.rate != config->sample_rate ||
         audio_channel_count_from_in_mask(config->channel_mask) != in->config.channels ||
-        in->config.format != pcm_format_from_audio_format(config->format)) {
-        config->format = audio_format_from_pcm_format(in->config.format);
+        in->format != config->format) {
+        config->format = (source == AUDIO_SOURCE_ECHO_REFERENCE) ? in->format
+                                                                 : AUDIO_FORMAT_PCM_16_BIT;
         config->channel_mask = audio_channel_in_mask_from_count(in->config.channels);
         config->sample_rate = in->config.rate;
         goto error_1;
     }
 
-    ALOGI("adev_open_input_stream selects channels=%d rate=%d format=%d source=%d",
-          in->config.channels, in->config.rate, in->config.format, source);
+    ALOGI("adev_open_input_stream selects channels=%d rate=%d format=%#x source=%d",
+          in->config.channels, in->config.rate, in->format, source);
 
     in->dev = ladev;
     in->standby = true;
     in->unavailable = false;
     in->source = source;
+    stream_stats_init(&in->stats);
     in->devices = devices;
 
     if (is_aec_input(in)) {
-        int aec_ret = init_aec_mic_config(ladev->aec, in);
+        int aec_ret = init_aec_mic_config(ladev->aec, &in->config);
         if (aec_ret) {
             ALOGE("AEC: Mic config init failed!");
             goto error_1;
@@ -1111,6 +1889,7 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
 {
     ALOGV("adev_close_input_stream...");
     struct alsa_stream_in* in = (struct alsa_stream_in*)stream;
+    in_standby(&stream->common);
     if (is_aec_input(in)) {
         destroy_aec_mic_config(in->dev->aec);
     }
@@ -1129,6 +1908,9 @@ static int adev_close(hw_device_t *device)
     ALOGV("adev_close");
 
     struct alsa_audio_device *adev = (struct alsa_audio_device *)device;
+    eq_cache_release(adev->eq_cache);
+    capture_hub_release(adev->capture_hub);
+    standby_timer_release(adev->standby_timer);
     release_aec(adev->aec);
     audio_route_free(adev->audio_route);
     mixer_close(adev->mixer);
@@ -1175,6 +1957,8 @@ static int adev_open(const hw_module_t* module, const char* name,
 
     *device = &adev->hw_device.common;
 
+    adev->master_volume = 1.0f;
+
     adev->mixer = mixer_open(CARD_OUT);
     if (!adev->mixer) {
         ALOGE("Unable to open the mixer, aborting.");
@@ -1187,8 +1971,24 @@ static int adev_open(const hw_module_t* module, const char* name,
         goto error_2;
     }
 
+    /* The beamformer is optional: without it, or if the array geometry does not suit it, two
+     * mics are captured as stereo. */
+    beamformer_t* beamformer = NULL;
+    if (property_get_bool(CAPTURE_BEAMFORMER_PROPERTY, false)) {
+        char azimuth[PROPERTY_VALUE_MAX];
+        property_get(CAPTURE_BEAMFORMER_AZIMUTH_PROPERTY, azimuth, "0");
+        beamformer = beamformer_init(CAPTURE_MIC_ARRAY_CHANNELS, CAPTURE_CODEC_SAMPLING_RATE,
+                                     kMicArrayLocations, strtof(azimuth, NULL),
+                                     CAPTURE_PERIOD_SIZE);
+        if (beamformer == NULL) {
+            ALOGE("%s: Failed to init beamformer, capturing stereo.", __func__);
+        }
+    }
+    const unsigned int mic_channels =
+            (beamformer != NULL) ? CAPTURE_MIC_ARRAY_CHANNELS : CHANNEL_STEREO;
+
     struct aec_params params = {
-            .num_mic_channels = CHANNEL_STEREO,
+            .num_mic_channels = mic_channels,
             .num_reference_channels = NUM_AEC_REFERENCE_CHANNELS,
             .num_playback_channels = CHANNEL_STEREO,
             .mic_sampling_rate_hz = CAPTURE_CODEC_SAMPLING_RATE,
@@ -1201,9 +2001,73 @@ static int adev_open(const hw_module_t* module, const char* name,
     }
     pthread_mutex_unlock(&adev->lock);
 
+    struct pcm_config capture_config = {
+            .channels = mic_channels,
+            .rate = CAPTURE_CODEC_SAMPLING_RATE,
+            .format = PCM_FORMAT_S32_LE,
+            .period_size = CAPTURE_PERIOD_SIZE,
+            .period_count = CAPTURE_PERIOD_COUNT,
+    };
+    /* Pre-roll extends the ring by as many periods as needed to hold it */
+    int32_t preroll_ms = property_get_int32(CAPTURE_PREROLL_MS_PROPERTY, 0);
+    adev->capture_preroll_ms = (preroll_ms > 0) ? preroll_ms : 0;
+    size_t preroll_frames = (size_t)adev->capture_preroll_ms * CAPTURE_CODEC_SAMPLING_RATE / 1000;
+    size_t ring_periods = CAPTURE_HUB_RING_PERIODS +
+                          (preroll_frames + CAPTURE_PERIOD_SIZE - 1) / CAPTURE_PERIOD_SIZE;
+    /* DC removal and high-pass ahead of AEC, skipped if they cannot be set up */
+    int32_t highpass_hz =
+            property_get_int32(CAPTURE_HIGHPASS_HZ_PROPERTY, CAPTURE_HIGHPASS_DEFAULT_HZ);
+    mic_preproc_t* preproc = mic_preproc_init(mic_channels, CAPTURE_CODEC_SAMPLING_RATE,
+                                              (highpass_hz > 0) ? highpass_hz : 0);
+    if (preproc == NULL) {
+        ALOGE("%s: Failed to init mic preprocessing, capturing unfiltered.", __func__);
+    }
+    adev->capture_hub = capture_hub_init(CARD_IN, PORT_BUILTIN_MIC, &capture_config, adev->aec,
+                                         preproc, beamformer, ring_periods,
+                                         adev->capture_preroll_ms > 0);
+    if (!adev->capture_hub) {
+        ALOGE("%s: Failed to init capture hub, aborting.", __func__);
+        mic_preproc_release(preproc);
+        goto error_4;
+    }
+    beamformer = NULL; /* owned by the hub, like preproc */
+    if (adev->capture_preroll_ms > 0) {
+        ALOGI("%s: Background capture with %" PRIu32 " ms pre-roll", __func__,
+              adev->capture_preroll_ms);
+        if (capture_hub_set_background(adev->capture_hub, true)) {
+            ALOGE("%s: Failed to start background capture", __func__);
+        }
+    }
+
+    adev->eq_cache = eq_cache_init(SPEAKER_MAX_EQ_LENGTH);
+    if (!adev->eq_cache) {
+        ALOGE("%s: Failed to init EQ cache, aborting.", __func__);
+        goto error_5;
+    }
+
+    adev->standby_timer = standby_timer_init();
+    if (!adev->standby_timer) {
+        ALOGE("%s: Failed to init standby timer, aborting.", __func__);
+        goto error_6;
+    }
+    int32_t warm_standby_ms = property_get_int32(WARM_STANDBY_MS_PROPERTY,
+                                                 WARM_STANDBY_DEFAULT_MS);
+    if (warm_standby_ms > 0) {
+        adev->warm_standby_ms = warm_standby_ms;
+        capture_hub_set_warm_standby(adev->capture_hub, adev->standby_timer,
+                                     adev->warm_standby_ms);
+    }
+
     return 0;
 
+error_6:
+    eq_cache_release(adev->eq_cache);
+error_5:
+    capture_hub_release(adev->capture_hub);
+error_4:
+    release_aec(adev->aec);
 error_3:
+    beamformer_release(beamformer);
     audio_route_free(adev->audio_route);
 error_2:
     mixer_close(adev->mixer);
@@ -18,9 +18,17 @@
 #define _YUKAWA_AUDIO_HW_H_
 
 #include <hardware/audio.h>
+#include <stdatomic.h>
 #include <tinyalsa/asoundlib.h>
 
-#include "fir_filter.h"
+#include "capture_hub.h"
+#include "iec61937.h"
+#include "proc_budget.h"
+#include "standby_timer.h"
+#include "stream_stats.h"
+
+struct eq_cache;
+#include "eq_filter.h"
 
 #define CARD_OUT 0
 #define PORT_HDMI 0
@@ -29,6 +37,12 @@
 #define PORT_BUILTIN_MIC 3
 
 #define MIXER_XML_PATH "/vendor/etc/mixer_paths.xml"
+
+/* IEC958 channel status of the HDMI output, and the non-audio flag in its first byte */
+#define IEC958_STATUS_CTL "IEC958 Playback Default"
+#define IEC958_STATUS_BYTES 24
+#define IEC958_AES0_NONAUDIO 0x02
+
 /* Minimum granularity - Arbitrary but small value */
 #define CODEC_BASE_FRAME_COUNT 32
 
@@ -45,6 +59,10 @@
 
 #define PCM_OPEN_RETRIES 100
 #define PCM_OPEN_WAIT_TIME_MS 20
+/* How long a PCM stays open, stopped and prepared, after standby before it is closed. 0 closes
+ * it on standby. */
+#define WARM_STANDBY_MS_PROPERTY "ro.vendor.audio.warm_standby_ms"
+#define WARM_STANDBY_DEFAULT_MS 3000
 
 /* Capture codec parameters */
 /* Set up a capture period of 32 ms:
@@ -55,6 +73,24 @@
 #define CAPTURE_PERIOD_COUNT 4
 #define CAPTURE_PERIOD_START_THRESHOLD 0
 #define CAPTURE_CODEC_SAMPLING_RATE 16000
+/* Mics of the built-in array, see kMicArrayLocations */
+#define CAPTURE_MIC_ARRAY_CHANNELS 4
+/* When set, all mics of the array are captured and beamformed to one channel after AEC, so mic
+ * streams are mono. Otherwise two mics are captured as stereo. */
+#define CAPTURE_BEAMFORMER_PROPERTY "ro.vendor.audio.beamformer"
+/* Look direction of the beamformer, in degrees counterclockwise from the x axis of the array */
+#define CAPTURE_BEAMFORMER_AZIMUTH_PROPERTY "ro.vendor.audio.beamformer_azimuth"
+/* Corner frequency of the high-pass applied to every mic before AEC, 0 to only remove DC */
+#define CAPTURE_HIGHPASS_HZ_PROPERTY "ro.vendor.audio.mic_highpass_hz"
+#define CAPTURE_HIGHPASS_DEFAULT_HZ 80
+/* Number of capture periods buffered by the capture hub for its readers (~0.5 s) */
+#define CAPTURE_HUB_RING_PERIODS 16
+/* Length of always-on pre-roll capture kept for new input streams, 0 disables it */
+#define CAPTURE_PREROLL_MS_PROPERTY "ro.vendor.audio.capture_preroll_ms"
+/* Device parameter to turn background pre-roll capture on and off at runtime */
+#define AUDIO_PARAMETER_CAPTURE_PREROLL "capture_preroll"
+/* Input stream parameter, set before the first read, to start that many ms in the past */
+#define AUDIO_PARAMETER_CAPTURE_REWIND_MS "capture_rewind_ms"
 
 /* Playback codec parameters */
 /* number of base blocks in a short period (low latency) */
@@ -64,22 +100,39 @@
 /* number of pseudo periods for low latency playback */
 #define PLAYBACK_PERIOD_COUNT 4
 #define PLAYBACK_PERIOD_START_THRESHOLD 2
+/* Repeated underruns first raise the start threshold by a period, then add periods up to this */
+#define PLAYBACK_MAX_PERIOD_COUNT 8
+/* Underruns within PLAYBACK_XRUN_WINDOW_MS that trigger one step of the above */
+#define PLAYBACK_XRUN_ESCALATE_COUNT 3
+#define PLAYBACK_XRUN_WINDOW_MS 5000
 #define PLAYBACK_CODEC_SAMPLING_RATE 48000
 #define MIN_WRITE_SLEEP_US      5000
+/* Length of output volume and mute ramps */
+#define PLAYBACK_GAIN_RAMP_MS 10
+/* Share of the audio duration output processing may take before the speaker EQ is degraded */
+#define PLAYBACK_PROC_BUDGET_PERCENT 50
 
 #define SPEAKER_EQ_FILE "/vendor/etc/speaker_eq_sei610.fir"
 #define SPEAKER_MAX_EQ_LENGTH 512
+/* Output stream parameter: re-read SPEAKER_EQ_FILE and crossfade to it */
+#define AUDIO_PARAMETER_SPEAKER_EQ_RELOAD "speaker_eq_reload"
 
 struct alsa_audio_device {
     struct audio_hw_device hw_device;
 
     pthread_mutex_t lock;   /* see notes in in_read/out_write on mutex acquisition order */
-    struct alsa_stream_in *active_input;
+    struct capture_hub* capture_hub;
     struct alsa_stream_out *active_output;
     struct audio_route *audio_route;
     struct mixer *mixer;
     bool mic_mute;
+    float master_volume;
+    bool master_mute;
     struct aec_t *aec;
+    uint32_t capture_preroll_ms;
+    struct eq_cache* eq_cache; /* parsed EQ files shared by all output streams */
+    struct standby_timer* standby_timer; /* closes PCMs left open by warm standby */
+    uint32_t warm_standby_ms;
 };
 
 struct alsa_stream_in {
@@ -87,15 +140,22 @@ struct alsa_stream_in {
 
     pthread_mutex_t lock;   /* see note in in_read() on mutex acquisition order */
     audio_devices_t devices;
+    audio_format_t format;  /* delivered format, may differ from config.format */
     struct pcm_config config;
-    struct pcm *pcm;
+    struct capture_hub_reader hub_reader;
     bool unavailable;
     bool standby;
     struct alsa_audio_device *dev;
     int read_threshold;
     unsigned int frames_read;
     uint64_t timestamp_nsec;
+    unsigned int timestamp_frames; /* position of the frame captured at timestamp_nsec */
+    /* Echo reference silence pacing: frames delivered since pace_base_nsec, 0 when not pacing */
+    uint64_t pace_base_nsec;
+    uint64_t pace_frames;
     audio_source_t source;
+    uint32_t rewind_ms;
+    stream_stats_t stats;   /* written by in_read() */
 };
 
 struct alsa_stream_out {
@@ -104,14 +164,50 @@ struct alsa_stream_out {
     pthread_mutex_t lock;   /* see note in out_write() on mutex acquisition order */
     audio_devices_t devices;
     struct pcm_config config;
-    struct pcm *pcm;
+    struct pcm *pcm;       /* open while playing, and while in warm standby */
+    int pcm_port;          /* port the PCM was opened on */
+    struct standby_timer_entry close_timer;
+    /* Rerouting: out_set_parameters() sets reroute_port, the standby timer thread opens a PCM on
+     * it into pending_pcm, and out_write() fades out, switches to it and leaves the old PCM in
+     * retired_pcm for that thread to close. All under the stream mutex. */
+    int reroute_port;
+    struct pcm* pending_pcm;
+    int pending_port;
+    enum pcm_format pending_format; /* the new port may not take 32-bit samples */
+    struct pcm* retired_pcm;
+    bool reroute_fading;   /* ramping to silence before switching to pending_pcm */
+    struct standby_timer_entry reroute_timer;
     bool unavailable;
     int standby;
     struct alsa_audio_device *dev;
     int write_threshold;
     unsigned int frames_written;
     struct timespec timestamp;
-    fir_filter_t* speaker_eq;
+    eq_filter_t* speaker_eq;   /* owned by out_write() once the stream is open */
+    /* EQ hand-over without locks: out_set_parameters() publishes a new filter in pending_eq,
+     * out_write() adopts it at a chunk boundary and hands the old one back in retired_eq. */
+    _Atomic(eq_filter_t*) pending_eq;
+    _Atomic(eq_filter_t*) retired_eq;
+    void* eq_scratch;           /* previous EQ output during a crossfade */
+    audio_format_t format; /* stream format, converted to config.format when not 16-bit */
+    size_t process_frames; /* frames processed per pcm_write(), one period */
+    int8_t* stage_buf;     /* processed codec frames of short writes, until a period is full */
+    int8_t* stage_ref;     /* their echo reference, if the codec is not 16-bit */
+    size_t stage_frames;
+    int32_t* proc_buf;     /* Q31 working buffer, for non 16-bit streams */
+    int16_t* ref_buf;      /* 16-bit codec output or echo reference, for non 16-bit streams */
+    iec61937_t* iec61937;  /* AC3/E-AC3 passthrough to HDMI, NULL for PCM streams */
+    bool iec958_non_audio;     /* channel status marked non-audio while passthrough plays */
+    uint8_t iec958_saved_aes0; /* channel status byte 0 to restore afterwards */
+    float volume;
+    gain_ramp_t gain;      /* master and stream volume, owned by out_write() */
+    proc_budget_t budget;  /* output processing time, owned by out_write() */
+    bool eq_bypassed;      /* speaker EQ skipped at PROC_QUALITY_MINIMAL */
+    stream_stats_t stats;  /* written by out_write() */
+    unsigned int start_threshold_periods;
+    unsigned int xrun_window_count;     /* underruns since xrun_window_start_nsec */
+    uint64_t xrun_window_start_nsec;
+    bool reopen_pcm;       /* PCM config changed or device failed: reopen on next write */
 };
 
 /* 'bytes' are the number of bytes written to audio FIFO, for which 'timestamp' is valid.
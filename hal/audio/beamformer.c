@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_beamformer"
+//#define LOG_NDEBUG 0
+
+#include <audio_utils/primitives.h>
+#include <log/log.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "beamformer.h"
+#include "rt_support.h"
+
+#ifdef __ARM_NEON
+#include "arm_neon.h"
+#endif /* #ifdef __ARM_NEON */
+
+/* Hann windowed sinc delaying by 'delay' frames, 'delay' within the taps, with unity DC gain
+ * split over 'mics' so the delayed mics can simply be added up. */
+static void beamformer_design_delay(float delay, uint32_t length, uint32_t mics, int16_t* taps) {
+    const float half_width = BEAMFORMER_FRAC_TAPS / 2.0f;
+    float h[length];
+    float sum = 0.0f;
+    for (uint32_t k = 0; k < length; k++) {
+        float x = (float)k - delay;
+        h[k] = 0.0f;
+        if (fabsf(x) < half_width) {
+            float sinc = (fabsf(x) < 1e-6f) ? 1.0f : sinf((float)M_PI * x) / ((float)M_PI * x);
+            h[k] = sinc * (0.5f + 0.5f * cosf((float)M_PI * x / half_width));
+        }
+        sum += h[k];
+    }
+    for (uint32_t k = 0; k < length; k++) {
+        taps[k] = clamp16(lrintf(h[k] / (sum * mics) * 32768.0f));
+    }
+}
+
+beamformer_t* beamformer_init(uint32_t mics, uint32_t rate,
+                              const struct audio_microphone_coordinate* location,
+                              float azimuth_deg, uint32_t input_length) {
+    if ((mics == 0) || (mics > BEAMFORMER_MAX_MICS) || (rate == 0) || (location == NULL)) {
+        ALOGE("%s: Invalid mic count, rate or locations.", __func__);
+        return NULL;
+    }
+
+    /* A plane wave from the look direction reaches mic i ahead of the array origin by
+     * (location[i] . u) / c: delay every mic to line up with the one it reaches last. */
+    const float azimuth = azimuth_deg * (float)M_PI / 180.0f;
+    const float ux = cosf(azimuth);
+    const float uy = sinf(azimuth);
+    float lead[BEAMFORMER_MAX_MICS];
+    float min_lead = 0.0f;
+    float max_lead = 0.0f;
+    for (uint32_t i = 0; i < mics; i++) {
+        if ((location[i].x == AUDIO_MICROPHONE_COORDINATE_UNKNOWN) ||
+            (location[i].y == AUDIO_MICROPHONE_COORDINATE_UNKNOWN)) {
+            ALOGE("%s: Location of mic %u unknown.", __func__, i);
+            return NULL;
+        }
+        lead[i] = (location[i].x * ux + location[i].y * uy) / BEAMFORMER_SPEED_OF_SOUND * rate;
+        if ((i == 0) || (lead[i] < min_lead)) {
+            min_lead = lead[i];
+        }
+        if ((i == 0) || (lead[i] > max_lead)) {
+            max_lead = lead[i];
+        }
+    }
+    if (max_lead - min_lead > BEAMFORMER_MAX_DELAY_FRAMES) {
+        ALOGE("%s: Array too large, %.1f frames of delay.", __func__, max_lead - min_lead);
+        return NULL;
+    }
+
+    beamformer_t* bf = (beamformer_t*)rt_heap_calloc(1, sizeof(beamformer_t));
+    if (bf == NULL) {
+        ALOGE("%s: Unable to allocate memory for beamformer.", __func__);
+        return NULL;
+    }
+    bf->mics = mics;
+    bf->rate = rate;
+    bf->azimuth_deg = azimuth_deg;
+
+    /* Every interpolator is centred half its width in, so the smallest delay is causal too */
+    uint32_t length = BEAMFORMER_FRAC_TAPS + (uint32_t)ceilf(max_lead - min_lead);
+    int16_t* taps = (int16_t*)calloc((size_t)mics * length, sizeof(int16_t));
+    if (taps == NULL) {
+        ALOGE("%s: Unable to allocate memory for delay taps.", __func__);
+        goto exit_1;
+    }
+    for (uint32_t i = 0; i < mics; i++) {
+        float delay = (BEAMFORMER_FRAC_TAPS - 1) / 2.0f + (lead[i] - min_lead);
+        beamformer_design_delay(delay, length, mics, &taps[i * length]);
+        ALOGV("%s: mic %u delayed by %.2f frames", __func__, i, delay);
+    }
+    bf->fir = fir_init(mics, FIR_PER_CHANNEL_FILTER, FIR_SAMPLES_Q31, length, input_length, taps);
+    free(taps);
+    if (bf->fir == NULL) {
+        goto exit_1;
+    }
+
+    bf->delayed = (int32_t*)rt_heap_calloc((size_t)input_length * mics, sizeof(int32_t));
+    if (bf->delayed == NULL) {
+        ALOGE("%s: Unable to allocate memory for delayed mics.", __func__);
+        goto exit_2;
+    }
+
+    ALOGI("%s: %u mics steered to %.0f degrees, %u taps", __func__, mics, azimuth_deg, length);
+    return bf;
+
+exit_2:
+    fir_release(bf->fir);
+exit_1:
+    rt_heap_free(bf);
+    return NULL;
+}
+
+void beamformer_release(beamformer_t* bf) {
+    if (bf == NULL) {
+        return;
+    }
+    rt_heap_free(bf->delayed);
+    fir_release(bf->fir);
+    rt_heap_free(bf);
+}
+
+void beamformer_reset(beamformer_t* bf) {
+    if (bf == NULL) {
+        return;
+    }
+    fir_reset(bf->fir);
+}
+
+int32_t* beamformer_get_input(beamformer_t* bf) {
+    return fir_get_input_q31(bf->fir);
+}
+
+void beamformer_process(beamformer_t* bf, int32_t* output, uint32_t frames) {
+    const uint32_t mics = bf->mics;
+    fir_process_interleaved_q31(bf->fir, bf->delayed, frames, NULL);
+
+    const int32_t* p_delayed = bf->delayed;
+    for (uint32_t s = 0; s < frames; s++, p_delayed += mics) {
+        int64_t sum = 0;
+        uint32_t ch = 0;
+#ifdef __ARM_NEON
+        int64x2_t sum_vec = vdupq_n_s64(0);
+        for (; ch + 4 <= mics; ch += 4) {
+            sum_vec = vpadalq_s32(sum_vec, vld1q_s32(&p_delayed[ch]));
+        }
+        sum = vgetq_lane_s64(sum_vec, 0) + vgetq_lane_s64(sum_vec, 1);
+#endif /* #ifdef __ARM_NEON */
+        for (; ch < mics; ch++) {
+            sum += p_delayed[ch];
+        }
+        output[s] = clamp32(sum);
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Delay-and-sum beamformer: steers a microphone array towards one direction and mixes it down to
+ * a single channel.
+ *
+ * Each mic is delayed so that a plane wave from the look direction lines up on all of them, then
+ * the mics are averaged: sound from that direction adds up coherently, noise and reverberation
+ * from elsewhere do not. Delays are rarely whole samples at 16 kHz, so each mic gets its own
+ * windowed-sinc fractional delay FIR. The whole array is one per-channel Q31 FIR, with the
+ * integer part of each delay folded into its taps, so it runs on the fir_filter kernels.
+ */
+
+#ifndef BEAMFORMER_H
+#define BEAMFORMER_H
+
+#include <stdint.h>
+#include <system/audio.h>
+
+#include "fir_filter.h"
+
+/* Most mics an array may have */
+#define BEAMFORMER_MAX_MICS 8
+/* Taps of each fractional delay interpolator, even. The array adds BEAMFORMER_FRAC_TAPS / 2
+ * frames of latency on top of its largest steering delay. */
+#define BEAMFORMER_FRAC_TAPS 8
+/* Largest steering delay, i.e. array aperture: 32 frames is about 0.7 m at 16 kHz */
+#define BEAMFORMER_MAX_DELAY_FRAMES 32
+#define BEAMFORMER_SPEED_OF_SOUND 343.0f /* m/s */
+
+typedef struct beamformer {
+    uint32_t mics;
+    uint32_t rate;
+    float azimuth_deg;
+    fir_filter_t* fir;  /* one delay filter per mic, pre-scaled by 1 / mics */
+    int32_t* delayed;   /* delayed mics, interleaved */
+} beamformer_t;
+
+/* Create a beamformer for 'mics' channels at 'rate', with mic 'i' at 'location[i]' in metres
+ * (device coordinates, as in audio_microphone_characteristic_t), processing up to 'input_length'
+ * frames per call. The look direction is 'azimuth_deg' in the horizontal (x, y) plane,
+ * counterclockwise from the x axis.
+ * Returns NULL if a location is unknown or the array is larger than the delay filters allow. */
+beamformer_t* beamformer_init(uint32_t mics, uint32_t rate,
+                              const struct audio_microphone_coordinate* location,
+                              float azimuth_deg, uint32_t input_length);
+void beamformer_release(beamformer_t* bf);
+void beamformer_reset(beamformer_t* bf);
+
+/* Write 'frames' interleaved Q31 frames of all mics at beamformer_get_input(), e.g. straight from
+ * pcm_read() and AEC, then call beamformer_process() to get the mono output. */
+int32_t* beamformer_get_input(beamformer_t* bf);
+void beamformer_process(beamformer_t* bf, int32_t* output, uint32_t frames);
+
+#endif /* #ifndef BEAMFORMER_H */
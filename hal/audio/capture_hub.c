@@ -0,0 +1,563 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_capture_hub"
+// #define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <audio_utils/clock.h>
+#include <log/log.h>
+
+#include "audio_aec.h"
+#include "capture_hub.h"
+#include "pcm_convert.h"
+#include "rt_support.h"
+
+/* Readers give up waiting after this many periods without a new one being published. */
+#define CAPTURE_HUB_READ_TIMEOUT_PERIODS 4
+/* Share of a period AEC may take before the hub starts skipping AEC blocks. */
+#define CAPTURE_HUB_AEC_BUDGET_PERCENT 50
+
+static uint64_t capture_hub_period_nsec(const struct capture_hub* hub, size_t frames) {
+    return (uint64_t)frames * NANOS_PER_SECOND / hub->config.rate;
+}
+
+static uint64_t capture_hub_now_nsec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return audio_utils_ns_from_timespec(&now);
+}
+
+/* Capture time at the end of the period just read, from the PCM hardware timestamp.
+ * This is the timestamp AEC expects for the mic buffer. */
+static int capture_hub_get_timestamp(struct capture_hub* hub, struct aec_info* info) {
+    if (pcm_get_htimestamp(hub->pcm, &info->available, &info->timestamp) < 0) {
+        ALOGE("Error getting PCM timestamp!");
+        info->timestamp.tv_sec = 0;
+        info->timestamp.tv_nsec = 0;
+        return -EINVAL;
+    }
+    uint64_t nsec = audio_utils_ns_from_timespec(&info->timestamp);
+    nsec -= capture_hub_period_nsec(hub, info->available); /* rewind timestamp */
+    info->timestamp.tv_sec = nsec / NANOS_PER_SECOND;
+    info->timestamp.tv_nsec = nsec % NANOS_PER_SECOND;
+    return 0;
+}
+
+/* tinyalsa restarts a capture PCM after an overrun without reporting it. Spot the gap this
+ * leaves in the hardware timestamps instead, and realign the echo reference across it. */
+static void capture_hub_check_overrun(struct capture_hub* hub, uint64_t timestamp_nsec) {
+    uint64_t period_nsec = capture_hub_period_nsec(hub, hub->period_frames);
+    if ((hub->last_capture_nsec != 0) &&
+        (timestamp_nsec > hub->last_capture_nsec + period_nsec * 3 / 2)) {
+        ALOGW("%s: overrun, %" PRIu64 " ms of capture lost", __func__,
+              (timestamp_nsec - hub->last_capture_nsec - period_nsec) / NANOS_PER_MILLISECOND);
+        stream_stats_add_xrun(&hub->stats);
+        aec_reference_discontinuity(hub->aec);
+    }
+    hub->last_capture_nsec = timestamp_nsec;
+}
+
+static void capture_hub_publish(struct capture_hub* hub, uint64_t write_frames) {
+    atomic_store_explicit(&hub->write_frames, write_frames, memory_order_release);
+    pthread_mutex_lock(&hub->wait_lock);
+    pthread_cond_broadcast(&hub->period_cond);
+    pthread_mutex_unlock(&hub->wait_lock);
+}
+
+/* Run AEC on the period at 'buffer', within the processing budget: at reduced quality AEC runs
+ * on every other period, at minimal quality not at all. Skipped periods keep the raw mic signal
+ * and only consume the echo reference, so AEC stays in step for when it resumes.
+ * Returns the time AEC took. */
+static uint64_t capture_hub_run_aec(struct capture_hub* hub, void* buffer, struct aec_info* info) {
+    proc_quality_t quality = hub->aec_budget.quality;
+    hub->aec_skip_next = (quality == PROC_QUALITY_REDUCED) && !hub->aec_skip_next;
+    bool skip = (quality == PROC_QUALITY_MINIMAL) || hub->aec_skip_next;
+
+    uint64_t start_nsec = proc_budget_now_nsec();
+    int aec_ret = skip ? skip_aec(hub->aec, info) : process_aec(hub->aec, buffer, info);
+    if (aec_ret) {
+        ALOGE("%s returned error code %d", skip ? "skip_aec" : "process_aec", aec_ret);
+    }
+    uint64_t elapsed_nsec = proc_budget_now_nsec() - start_nsec;
+    proc_budget_update(&hub->aec_budget, elapsed_nsec, hub->period_frames);
+    return elapsed_nsec;
+}
+
+static void* capture_hub_thread(void* context) {
+    struct capture_hub* hub = (struct capture_hub*)context;
+    const size_t period_bytes = hub->period_frames * hub->frame_size;
+    const size_t capture_bytes = hub->period_frames * hub->capture_frame_size;
+
+    ALOGV("%s enter", __func__);
+    rt_thread_configure("capture_hub");
+    bool was_muted = false;
+    while (!atomic_load_explicit(&hub->exit_thread, memory_order_relaxed)) {
+        /* One period, on preallocated, locked buffers */
+        rt_hot_path_enter();
+        /* Muted periods skip the processing, whose history is stale once unmuted: restart it
+         * before the capture, as the beamformer reset also clears its input */
+        bool muted = atomic_load_explicit(&hub->mic_mute, memory_order_relaxed);
+        if (was_muted && !muted) {
+            mic_preproc_reset(hub->preproc);
+            beamformer_reset(hub->beamformer);
+        }
+        was_muted = muted;
+        uint64_t write_frames = atomic_load_explicit(&hub->write_frames, memory_order_relaxed);
+        size_t period = (write_frames / hub->period_frames) % hub->ring_periods;
+        int8_t* dst = &hub->ring[period * period_bytes];
+
+        /* Capture straight into the ring: readers detect that this period is being
+         * overwritten from the write position, see capture_hub_read(). With beamforming the
+         * mics are captured into the beamformer history instead, and only its output is
+         * published. */
+        int8_t* capture = (hub->beamformer != NULL)
+                                  ? (int8_t*)beamformer_get_input(hub->beamformer)
+                                  : dst;
+        struct aec_info info;
+        uint64_t start_nsec = capture_hub_now_nsec();
+        int ret = pcm_read(hub->pcm, capture, capture_bytes);
+        stream_stats_add_io(&hub->stats, capture_hub_now_nsec() - start_nsec, hub->period_frames,
+                            ret != 0);
+        if (ret != 0) {
+            ALOGE("pcm_read failed: %s", pcm_get_error(hub->pcm));
+            memset(capture, 0, capture_bytes);
+            /* Recover now rather than leave the PCM in an error state, the next pcm_read()
+             * restarts it. Keep readers running at the nominal rate meanwhile. */
+            pcm_prepare(hub->pcm);
+            hub->last_capture_nsec = 0;
+            usleep(capture_hub_period_nsec(hub, hub->period_frames) / 1000);
+        }
+
+        uint64_t timestamp_nsec = 0;
+        if ((ret == 0) && (capture_hub_get_timestamp(hub, &info) == 0)) {
+            timestamp_nsec = audio_utils_ns_from_timespec(&info.timestamp);
+            capture_hub_check_overrun(hub, timestamp_nsec);
+        } else {
+            timestamp_nsec = capture_hub_now_nsec();
+        }
+
+        if (muted) {
+            memset(dst, 0, period_bytes);
+        } else {
+            uint64_t dsp_nsec = 0;
+            /* In place, so AEC gets the filtered mics without another copy. A lost period
+             * breaks the filter history, start it again on the next one. */
+            if ((hub->preproc != NULL) && (ret == 0)) {
+                uint64_t pp_start_nsec = proc_budget_now_nsec();
+                mic_preproc_process(hub->preproc, (int32_t*)capture, hub->period_frames);
+                dsp_nsec += proc_budget_now_nsec() - pp_start_nsec;
+            } else {
+                mic_preproc_reset(hub->preproc);
+            }
+            if (ret == 0) {
+                info.bytes = capture_bytes;
+                dsp_nsec += capture_hub_run_aec(hub, capture, &info);
+            }
+            /* Beamform after AEC: AEC models the echo path of each mic, which steering would
+             * blur. Failed reads still go through to keep the delay lines in step. */
+            if (hub->beamformer != NULL) {
+                uint64_t bf_start_nsec = proc_budget_now_nsec();
+                beamformer_process(hub->beamformer, (int32_t*)dst, hub->period_frames);
+                dsp_nsec += proc_budget_now_nsec() - bf_start_nsec;
+            }
+            if ((ret == 0) || (hub->beamformer != NULL)) {
+                stream_stats_add_dsp(&hub->stats, dsp_nsec);
+            }
+        }
+
+        hub->period_timestamp_nsec[period] =
+                timestamp_nsec - capture_hub_period_nsec(hub, hub->period_frames);
+        capture_hub_publish(hub, write_frames + hub->period_frames);
+        rt_hot_path_leave();
+    }
+    ALOGV("%s exit", __func__);
+    return NULL;
+}
+
+/* must be called with state_lock held */
+static int capture_hub_open_l(struct capture_hub* hub) {
+    unsigned int pcm_retry_count = PCM_OPEN_RETRIES;
+
+    while (1) {
+        hub->pcm = pcm_open(hub->card, hub->port, PCM_IN | PCM_MONOTONIC, &hub->config);
+        if ((hub->pcm != NULL) && pcm_is_ready(hub->pcm)) {
+            break;
+        } else {
+            ALOGE("cannot open pcm_in driver: %s", pcm_get_error(hub->pcm));
+            if (hub->pcm != NULL) {
+                pcm_close(hub->pcm);
+                hub->pcm = NULL;
+            }
+            if (--pcm_retry_count == 0) {
+                ALOGE("Failed to open pcm_in after %d tries", PCM_OPEN_RETRIES);
+                return -ENODEV;
+            }
+            usleep(PCM_OPEN_WAIT_TIME_MS * 1000);
+        }
+    }
+
+#ifdef AEC_HAL
+    if (init_aec_mic_config(hub->aec, &hub->config)) {
+        ALOGE("AEC: Mic config init failed!");
+    }
+#endif
+    return 0;
+}
+
+/* must be called with state_lock held */
+static void capture_hub_close_l(struct capture_hub* hub) {
+    if (hub->pcm == NULL) {
+        return;
+    }
+#ifdef AEC_HAL
+    destroy_aec_mic_config(hub->aec);
+#endif
+    pcm_close(hub->pcm);
+    hub->pcm = NULL;
+}
+
+/* must be called with state_lock held */
+static int capture_hub_start_l(struct capture_hub* hub) {
+    /* After a warm standby the PCM is still open and prepared, and AEC still configured */
+    if (hub->pcm == NULL) {
+        int ret = capture_hub_open_l(hub);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    proc_budget_reset(&hub->aec_budget);
+    mic_preproc_reset(hub->preproc);
+    beamformer_reset(hub->beamformer);
+    hub->last_capture_nsec = 0;
+    hub->session_start_frames = atomic_load_explicit(&hub->write_frames, memory_order_relaxed);
+    atomic_store(&hub->exit_thread, false);
+    if (pthread_create(&hub->thread, NULL, capture_hub_thread, hub)) {
+        ALOGE("%s: Failed to create capture thread", __func__);
+        capture_hub_close_l(hub);
+        return -ENODEV;
+    }
+    pthread_setname_np(hub->thread, "capture_hub");
+    hub->thread_started = true;
+    return 0;
+}
+
+/* must be called with state_lock held */
+static bool capture_hub_in_use_l(const struct capture_hub* hub) {
+    return hub->background || (hub->num_readers > 0);
+}
+
+/* Stop the capture thread, then close the PCM or, if 'warm' and warm standby is enabled, only
+ * stop it and leave it prepared for the next start.
+ * must be called with state_lock held */
+static void capture_hub_stop_l(struct capture_hub* hub, bool warm) {
+    if (hub->thread_started) {
+        atomic_store(&hub->exit_thread, true);
+        pthread_join(hub->thread, NULL);
+        hub->thread_started = false;
+    }
+    if (hub->pcm == NULL) {
+        return;
+    }
+
+    if (warm && (hub->warm_standby_ms > 0) && (pcm_stop(hub->pcm) == 0) &&
+        (pcm_prepare(hub->pcm) == 0)) {
+        standby_timer_arm(hub->standby_timer, &hub->close_timer, hub->warm_standby_ms);
+        return;
+    }
+    capture_hub_close_l(hub);
+}
+
+/* close_timer callback: the PCM has been idle for the whole warm standby period */
+static void capture_hub_close_expired(void* context) {
+    struct capture_hub* hub = (struct capture_hub*)context;
+    pthread_mutex_lock(&hub->state_lock);
+    if (!hub->thread_started && (proc_budget_now_nsec() >= hub->close_timer.deadline_nsec)) {
+        ALOGV("%s: closing idle capture PCM", __func__);
+        capture_hub_close_l(hub);
+    }
+    pthread_mutex_unlock(&hub->state_lock);
+}
+
+struct capture_hub* capture_hub_init(unsigned int card, unsigned int port,
+                                     const struct pcm_config* config, struct aec_t* aec,
+                                     mic_preproc_t* preproc, beamformer_t* beamformer,
+                                     size_t ring_periods, bool lock_ring) {
+    if ((config == NULL) || (config->format != PCM_FORMAT_S32_LE) || (ring_periods < 3) ||
+        ((preproc != NULL) && (preproc->channels != config->channels)) ||
+        ((beamformer != NULL) && (beamformer->mics != config->channels))) {
+        ALOGE("%s: Invalid PCM config, preprocessing, beamformer or ring size.", __func__);
+        return NULL;
+    }
+
+    struct capture_hub* hub = (struct capture_hub*)calloc(1, sizeof(struct capture_hub));
+    if (hub == NULL) {
+        ALOGE("%s: Unable to allocate memory for capture hub.", __func__);
+        return NULL;
+    }
+
+    hub->card = card;
+    hub->port = port;
+    hub->config = *config;
+    hub->aec = aec;
+    proc_budget_init(&hub->aec_budget, "capture AEC", config->rate, CAPTURE_HUB_AEC_BUDGET_PERCENT);
+    stream_stats_init(&hub->stats);
+    hub->preproc = preproc;
+    hub->beamformer = beamformer;
+    hub->channels = (beamformer != NULL) ? 1 : config->channels;
+    hub->frame_size = hub->channels * sizeof(int32_t);
+    hub->capture_frame_size = config->channels * sizeof(int32_t);
+    hub->period_frames = config->period_size;
+    hub->ring_periods = ring_periods;
+    hub->ring_frames = ring_periods * hub->period_frames;
+
+    /* A pre-roll ring may be far larger than the locked heap, it is locked on its own below */
+    hub->ring = lock_ring ? (int8_t*)calloc(hub->ring_frames, hub->frame_size)
+                          : (int8_t*)rt_heap_calloc(hub->ring_frames, hub->frame_size);
+    if (hub->ring == NULL) {
+        ALOGE("%s: Unable to allocate memory for capture ring.", __func__);
+        goto exit_1;
+    }
+    hub->period_timestamp_nsec = (uint64_t*)calloc(ring_periods, sizeof(uint64_t));
+    if (hub->period_timestamp_nsec == NULL) {
+        ALOGE("%s: Unable to allocate memory for capture timestamps.", __func__);
+        goto exit_2;
+    }
+    if (lock_ring) {
+        /* Not fatal: the ring still works, it may just take page faults when it wraps. */
+        if (mlock(hub->ring, hub->ring_frames * hub->frame_size) == 0) {
+            hub->ring_locked = true;
+        } else {
+            ALOGW("%s: Unable to lock capture ring: %s", __func__, strerror(errno));
+        }
+    }
+
+    standby_timer_entry_init(&hub->close_timer, capture_hub_close_expired, hub);
+    pthread_mutex_init(&hub->state_lock, NULL);
+    pthread_mutex_init(&hub->wait_lock, NULL);
+    pthread_cond_init(&hub->period_cond, NULL);
+    atomic_init(&hub->exit_thread, false);
+    atomic_init(&hub->mic_mute, false);
+    atomic_init(&hub->write_frames, 0);
+    return hub;
+
+exit_2:
+    rt_heap_free(hub->ring);
+exit_1:
+    free(hub);
+    return NULL;
+}
+
+void capture_hub_release(struct capture_hub* hub) {
+    if (hub == NULL) {
+        return;
+    }
+    if (hub->standby_timer != NULL) {
+        standby_timer_cancel(hub->standby_timer, &hub->close_timer);
+    }
+    pthread_mutex_lock(&hub->state_lock);
+    capture_hub_stop_l(hub, false /* warm */);
+    pthread_mutex_unlock(&hub->state_lock);
+
+    if (hub->ring_locked) {
+        munlock(hub->ring, hub->ring_frames * hub->frame_size);
+    }
+    pthread_cond_destroy(&hub->period_cond);
+    pthread_mutex_destroy(&hub->wait_lock);
+    pthread_mutex_destroy(&hub->state_lock);
+    free(hub->period_timestamp_nsec);
+    rt_heap_free(hub->ring);
+    mic_preproc_release(hub->preproc);
+    beamformer_release(hub->beamformer);
+    free(hub);
+}
+
+int capture_hub_attach(struct capture_hub* hub, struct capture_hub_reader* reader,
+                       size_t rewind_frames) {
+    int ret = 0;
+    pthread_mutex_lock(&hub->state_lock);
+    if (!capture_hub_in_use_l(hub)) {
+        ret = capture_hub_start_l(hub);
+    }
+    if (ret == 0) {
+        hub->num_readers++;
+        uint64_t write_frames = atomic_load_explicit(&hub->write_frames, memory_order_acquire);
+        uint64_t oldest = hub->session_start_frames;
+        /* Stay two periods clear of the writer, see capture_hub_lapped() */
+        if (write_frames + 2 * hub->period_frames > oldest + hub->ring_frames) {
+            oldest = write_frames + 2 * hub->period_frames - hub->ring_frames;
+        }
+        reader->read_frames = write_frames;
+        if (rewind_frames > write_frames - oldest) {
+            rewind_frames = write_frames - oldest;
+        }
+        reader->read_frames -= rewind_frames;
+        reader->frames_lost = 0;
+        ALOGV("%s: reader rewound by %zu frames", __func__, rewind_frames);
+    }
+    pthread_mutex_unlock(&hub->state_lock);
+    return ret;
+}
+
+void capture_hub_detach(struct capture_hub* hub, struct capture_hub_reader* reader) {
+    pthread_mutex_lock(&hub->state_lock);
+    if (hub->num_readers > 0) {
+        hub->num_readers--;
+    }
+    if (!capture_hub_in_use_l(hub)) {
+        capture_hub_stop_l(hub, true /* warm */);
+    }
+    pthread_mutex_unlock(&hub->state_lock);
+}
+
+int capture_hub_set_background(struct capture_hub* hub, bool enabled) {
+    int ret = 0;
+    pthread_mutex_lock(&hub->state_lock);
+    if (enabled && !capture_hub_in_use_l(hub)) {
+        ret = capture_hub_start_l(hub);
+    }
+    if (ret == 0) {
+        hub->background = enabled;
+    }
+    if (!capture_hub_in_use_l(hub)) {
+        capture_hub_stop_l(hub, true /* warm */);
+    }
+    pthread_mutex_unlock(&hub->state_lock);
+    return ret;
+}
+
+void capture_hub_set_warm_standby(struct capture_hub* hub, struct standby_timer* timer,
+                                  uint32_t warm_ms) {
+    pthread_mutex_lock(&hub->state_lock);
+    hub->standby_timer = timer;
+    hub->warm_standby_ms = (timer != NULL) ? warm_ms : 0;
+    pthread_mutex_unlock(&hub->state_lock);
+}
+
+/* The period after 'write_frames' may be in the middle of being captured, so a reader position
+ * is only safe while that period does not reuse its slot. */
+static bool capture_hub_lapped(const struct capture_hub* hub, uint64_t read_frames,
+                               uint64_t write_frames) {
+    return write_frames + hub->period_frames > read_frames + hub->ring_frames;
+}
+
+static void capture_hub_copy(const struct capture_hub* hub, uint64_t position, int8_t* dst,
+                             audio_format_t format, size_t frames, bool mute) {
+    const size_t dst_frame_size = hub->channels * audio_bytes_per_sample(format);
+    while (frames > 0) {
+        size_t offset = position % hub->ring_frames;
+        size_t count = hub->ring_frames - offset;
+        if (count > frames) {
+            count = frames;
+        }
+        pcm_convert_from_i32(dst, format, (const int32_t*)&hub->ring[offset * hub->frame_size],
+                             count * hub->channels, mute);
+        dst += count * dst_frame_size;
+        position += count;
+        frames -= count;
+    }
+}
+
+static int capture_hub_wait(struct capture_hub* hub, uint64_t write_frames) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    uint64_t nsec = audio_utils_ns_from_timespec(&deadline) +
+                    capture_hub_period_nsec(hub, hub->period_frames) *
+                            CAPTURE_HUB_READ_TIMEOUT_PERIODS;
+    deadline.tv_sec = nsec / NANOS_PER_SECOND;
+    deadline.tv_nsec = nsec % NANOS_PER_SECOND;
+
+    int ret = 0;
+    pthread_mutex_lock(&hub->wait_lock);
+    while ((ret == 0) &&
+           (atomic_load_explicit(&hub->write_frames, memory_order_acquire) == write_frames)) {
+        ret = pthread_cond_timedwait(&hub->period_cond, &hub->wait_lock, &deadline);
+    }
+    pthread_mutex_unlock(&hub->wait_lock);
+    return (ret == ETIMEDOUT) ? -ETIMEDOUT : 0;
+}
+
+int capture_hub_read(struct capture_hub* hub, struct capture_hub_reader* reader, void* buffer,
+                     audio_format_t format, size_t frames, bool mute, uint64_t* timestamp_nsec) {
+    const size_t dst_frame_size = hub->channels * audio_bytes_per_sample(format);
+    int8_t* dst = (int8_t*)buffer;
+    size_t done = 0;
+
+    while (done < frames) {
+        uint64_t write_frames = atomic_load_explicit(&hub->write_frames, memory_order_acquire);
+        if (capture_hub_lapped(hub, reader->read_frames, write_frames)) {
+            /* Too slow: skip ahead, keeping one period of margin from the writer. */
+            uint64_t position = write_frames + 2 * hub->period_frames - hub->ring_frames;
+            ALOGW("%s: reader lapped, dropping %" PRIu64 " frames", __func__,
+                  position - reader->read_frames);
+            reader->frames_lost += position - reader->read_frames;
+            reader->read_frames = position;
+        }
+
+        size_t available = write_frames - reader->read_frames;
+        if (available == 0) {
+            int ret = capture_hub_wait(hub, write_frames);
+            if (ret) {
+                ALOGE("%s: timed out waiting for capture", __func__);
+                return ret;
+            }
+            continue;
+        }
+
+        size_t count = frames - done;
+        if (count > available) {
+            count = available;
+        }
+        /* Only within the period of the frame: later periods may follow a gap */
+        size_t period = (reader->read_frames / hub->period_frames) % hub->ring_periods;
+        uint64_t timestamp =
+                hub->period_timestamp_nsec[period] +
+                capture_hub_period_nsec(hub, reader->read_frames % hub->period_frames);
+        capture_hub_copy(hub, reader->read_frames, &dst[done * dst_frame_size], format, count,
+                         mute);
+
+        /* Validate the copy: if the writer lapped us while copying, the data may be torn. */
+        atomic_thread_fence(memory_order_acquire);
+        write_frames = atomic_load_explicit(&hub->write_frames, memory_order_relaxed);
+        if (capture_hub_lapped(hub, reader->read_frames, write_frames)) {
+            continue;
+        }
+
+        if (done == 0) {
+            *timestamp_nsec = timestamp;
+        }
+        reader->read_frames += count;
+        done += count;
+    }
+    return 0;
+}
+
+void capture_hub_set_mic_mute(struct capture_hub* hub, bool muted) {
+    atomic_store_explicit(&hub->mic_mute, muted, memory_order_relaxed);
+}
+
+void capture_hub_dump(const struct capture_hub* hub, int fd, int indent) {
+    stream_stats_dump(&hub->stats, fd, indent,
+                      (hub->beamformer != NULL) ? "AEC and beamformer" : "AEC", NULL);
+}
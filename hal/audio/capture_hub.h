@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Capture hub: shares one microphone PCM between any number of input streams.
+ *
+ * A single thread owns the PCM, runs AEC once per period and publishes the processed periods
+ * into a ring. The ring has exactly one writer; readers never take a lock on the data path.
+ * Each reader keeps its own position and, after copying, checks that the writer has not lapped
+ * it in the meantime (seqlock style). The hub mutexes are only used to attach/detach readers
+ * and to sleep until the next period is published.
+ *
+ * Before AEC, every captured mic may go through DC removal and a high-pass (mic_preproc).
+ *
+ * The ring holds Q31 samples, the format AEC works in. Each reader converts to its own format
+ * while copying out of the ring, so narrower formats cost no extra pass.
+ *
+ * With a beamformer the hub captures every mic of the array but the ring, and so every reader,
+ * only gets the single beamformed channel.
+ *
+ * When the last reader detaches, the PCM may be left open and prepared for a while (warm
+ * standby), so a reader coming back soon does not pay for opening it and setting up AEC again.
+ *
+ * In background mode the hub keeps capturing with no reader attached, so the ring always holds
+ * the most recent audio. A newly attached reader may then rewind into it (pre-roll) and get the
+ * start of an utterance that was spoken before its stream was opened.
+ */
+
+#ifndef _YUKAWA_CAPTURE_HUB_H_
+#define _YUKAWA_CAPTURE_HUB_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <system/audio.h>
+#include <tinyalsa/asoundlib.h>
+
+#include "beamformer.h"
+#include "mic_preproc.h"
+#include "proc_budget.h"
+#include "standby_timer.h"
+#include "stream_stats.h"
+
+struct aec_t;
+
+struct capture_hub {
+    pthread_mutex_t state_lock; /* serializes reader attach/detach and thread start/stop */
+    pthread_mutex_t wait_lock;  /* only protects sleeping on period_cond */
+    pthread_cond_t period_cond; /* broadcast every time a period is published */
+    pthread_t thread;
+    bool thread_started;
+    atomic_bool exit_thread;
+    atomic_bool mic_mute;
+    bool background;  /* keep capturing with no reader attached */
+    bool ring_locked; /* ring is mlocked */
+    unsigned int card;
+    unsigned int port;
+    struct pcm* pcm;          /* open while capturing, and while in warm standby */
+    struct pcm_config config;
+    struct standby_timer* standby_timer;
+    uint32_t warm_standby_ms;  /* 0 closes the PCM as soon as capture stops */
+    struct standby_timer_entry close_timer;
+    struct aec_t* aec;
+    proc_budget_t aec_budget; /* AEC time per period, owned by the capture thread */
+    bool aec_skip_next;       /* alternates at PROC_QUALITY_REDUCED */
+    stream_stats_t stats;     /* pcm_read() and AEC, written by the capture thread */
+    mic_preproc_t* preproc;   /* filters the captured mics before AEC, or NULL */
+    beamformer_t* beamformer; /* mixes the captured mics down to one channel, or NULL */
+    size_t channels;          /* channels in the ring, delivered to readers */
+    size_t frame_size;
+    size_t capture_frame_size; /* frame size of the PCM, larger than frame_size if beamforming */
+    size_t period_frames;
+    size_t ring_periods;
+    size_t ring_frames;
+    int8_t* ring;
+    /* Capture time of the first frame of every ring period. */
+    uint64_t* period_timestamp_nsec;
+    /* Total number of frames published since the hub was created. */
+    atomic_uint_fast64_t write_frames;
+    /* Capture time of the last period read from the PCM, to spot silently recovered overruns */
+    uint64_t last_capture_nsec;
+    /* Value of write_frames when the capture thread last started: older frames are stale. */
+    uint64_t session_start_frames;
+    unsigned int num_readers;
+};
+
+struct capture_hub_reader {
+    uint64_t read_frames; /* hub position of the next frame to deliver */
+    uint64_t frames_lost; /* frames skipped because the reader was lapped by the writer */
+};
+
+/* Create a capture hub for PCM device 'card'/'port' opened with 'config', which must use
+ * PCM_FORMAT_S32_LE.
+ * 'ring_periods' is the number of periods kept in the ring, at least 3. Two of them are reserved
+ * as margin from the writer, the rest bound how far back a reader may rewind.
+ * 'lock_ring' mlocks the ring, for rings that are kept filled in background mode.
+ * 'aec' may be NULL if no AEC is to be run.
+ * 'preproc', if not NULL, must take config->channels mics. The hub takes ownership of it on
+ * success, and runs it on every captured period before AEC.
+ * 'beamformer', if not NULL, must take config->channels mics and at least a period per call. The
+ * hub takes ownership of it on success, and publishes its mono output after AEC.
+ * Returns NULL on failure. */
+struct capture_hub* capture_hub_init(unsigned int card, unsigned int port,
+                                     const struct pcm_config* config, struct aec_t* aec,
+                                     mic_preproc_t* preproc, beamformer_t* beamformer,
+                                     size_t ring_periods, bool lock_ring);
+
+/* Stop the capture thread if it is still running and free the hub. */
+void capture_hub_release(struct capture_hub* hub);
+
+/* Register a reader. The first reader opens the PCM and starts the capture thread.
+ * The reader starts 'rewind_frames' before the most recently published frame, clamped to what
+ * the ring holds from the current capture session.
+ * Returns -ENODEV if the PCM cannot be opened, else 0. */
+int capture_hub_attach(struct capture_hub* hub, struct capture_hub_reader* reader,
+                       size_t rewind_frames);
+
+/* Unregister a reader. The last reader stops the capture thread and stops or closes the PCM,
+ * see capture_hub_set_warm_standby(). */
+void capture_hub_detach(struct capture_hub* hub, struct capture_hub_reader* reader);
+
+/* Copy 'frames' frames to 'buffer' converted to 'format', blocking until they are captured.
+ * With 'mute' set silence is delivered instead, at the same pace.
+ * The capture time of the first copied frame is returned in 'timestamp_nsec'.
+ * Returns -ETIMEDOUT if the capture thread stopped delivering, else 0. */
+int capture_hub_read(struct capture_hub* hub, struct capture_hub_reader* reader, void* buffer,
+                     audio_format_t format, size_t frames, bool mute, uint64_t* timestamp_nsec);
+
+/* Enable or disable background capture. While enabled the capture thread runs even with no
+ * reader attached. Returns -ENODEV if the PCM cannot be opened, else 0. */
+int capture_hub_set_background(struct capture_hub* hub, bool enabled);
+
+/* Keep the PCM open and prepared for 'warm_ms' after capture stops, closing it from 'timer'.
+ * 0 closes it right away, the default. */
+void capture_hub_set_warm_standby(struct capture_hub* hub, struct standby_timer* timer,
+                                  uint32_t warm_ms);
+
+/* Mic mute state: while muted, the hub stores silence and skips AEC. */
+void capture_hub_set_mic_mute(struct capture_hub* hub, bool muted);
+
+/* Print the capture thread counters to 'fd', 'indent' spaces in. */
+void capture_hub_dump(const struct capture_hub* hub, int fd, int indent);
+
+#endif /* #ifndef _YUKAWA_CAPTURE_HUB_H_ */
@@ -0,0 +1,408 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_eq_coeffs"
+//#define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <log/log.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "eq_coeffs.h"
+
+#define EQ_CACHE_ENTRIES 4
+
+struct eq_coeffs {
+    eq_type_t type;
+    fir_filter_mode_t mode;
+    uint32_t num_sets;
+    uint32_t num_taps;       /* taps or biquad sections per set */
+    const int16_t* taps;     /* EQ_TYPE_FIR */
+    const int32_t* biquads;  /* EQ_TYPE_BIQUAD */
+    void* map;               /* mapping of a binary file, or NULL */
+    size_t map_size;
+    void* parsed;            /* coefficients parsed from a text file, or NULL */
+};
+
+struct eq_cache_entry {
+    bool valid;
+    uint64_t last_use;
+    char path[PATH_MAX];
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct eq_coeffs coeffs;
+};
+
+struct eq_cache {
+    pthread_mutex_t lock;
+    uint32_t max_taps;
+    uint64_t use_count;
+    struct eq_cache_entry entries[EQ_CACHE_ENTRIES];
+};
+
+static uint32_t crc32(const void* data, size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t crc = 0xffffffff;
+    while (size--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static void eq_coeffs_free(struct eq_coeffs* coeffs) {
+    if (coeffs->map != NULL) {
+        munmap(coeffs->map, coeffs->map_size);
+    }
+    free(coeffs->parsed);
+    memset(coeffs, 0, sizeof(*coeffs));
+}
+
+static int eq_load_binary(int fd, size_t size, uint32_t max_taps, struct eq_coeffs* coeffs) {
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        ALOGE("%s: mmap failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    const struct eq_coeffs_header* header = (const struct eq_coeffs_header*)map;
+    const void* data = header + 1;
+    bool biquad = (header->type == EQ_TYPE_BIQUAD);
+    size_t set_size = biquad ? header->num_taps * IIR_BIQUAD_COEFFS * sizeof(int32_t)
+                             : header->num_taps * sizeof(int16_t);
+    size_t data_size = (size_t)header->num_sets * set_size;
+    if ((header->version != EQ_COEFFS_VERSION) ||
+        ((header->type != EQ_TYPE_FIR) && (header->type != EQ_TYPE_BIQUAD)) ||
+        ((header->mode != FIR_SINGLE_FILTER) && (header->mode != FIR_PER_CHANNEL_FILTER)) ||
+        (header->num_sets == 0) || (header->num_sets > EQ_MAX_SETS) ||
+        ((header->mode == FIR_SINGLE_FILTER) && (header->num_sets != 1)) ||
+        (header->num_taps == 0) || (header->num_taps > (biquad ? IIR_MAX_SECTIONS : max_taps)) ||
+        (size != sizeof(*header) + data_size)) {
+        ALOGE("%s: Invalid header", __func__);
+        goto error;
+    }
+    if (crc32(data, data_size) != header->checksum) {
+        ALOGE("%s: Checksum mismatch", __func__);
+        goto error;
+    }
+    coeffs->type = (eq_type_t)header->type;
+    coeffs->mode = (fir_filter_mode_t)header->mode;
+    coeffs->num_sets = header->num_sets;
+    coeffs->num_taps = header->num_taps;
+    if (biquad) {
+        coeffs->biquads = (const int32_t*)data;
+    } else {
+        coeffs->taps = (const int16_t*)data;
+    }
+    coeffs->map = map;
+    coeffs->map_size = size;
+    return 0;
+
+error:
+    munmap(map, size);
+    return -EINVAL;
+}
+
+/* Close coefficient set 'set' of 'set_taps' taps or sections. All sets must match the first
+ * one's length. Returns false if they do not. */
+static bool eq_text_end_set(uint32_t set, uint32_t set_taps, uint32_t* num_taps) {
+    if (set == 0) {
+        *num_taps = set_taps;
+        return set_taps > 0;
+    }
+    if (set_taps != *num_taps) {
+        ALOGE("%s: Channel %" PRIu32 " has %" PRIu32 " coefficients, channel 0 has %" PRIu32,
+              __func__, set, set_taps, *num_taps);
+        return false;
+    }
+    return true;
+}
+
+/* Parse "@biquad b0 b1 b2 a1 a2" into Q28 'section'. Returns false if malformed. */
+static bool eq_text_parse_biquad(const char* line, int32_t* section) {
+    double c[IIR_BIQUAD_COEFFS];
+    if (sscanf(line, "@biquad %lf %lf %lf %lf %lf", &c[0], &c[1], &c[2], &c[3], &c[4]) !=
+        IIR_BIQUAD_COEFFS) {
+        return false;
+    }
+    const double scale = (double)(1 << IIR_COEFF_FRAC_BITS);
+    for (int i = 0; i < IIR_BIQUAD_COEFFS; i++) {
+        if ((c[i] <= -8.0) || (c[i] >= 8.0)) {
+            return false;
+        }
+        section[i] = (int32_t)lround(c[i] * scale);
+    }
+    return true;
+}
+
+static int eq_load_text(FILE* fp, uint32_t max_taps, struct eq_coeffs* coeffs) {
+    /* Sets are parsed a maximum length apart, then packed */
+    int16_t* taps = (int16_t*)calloc((size_t)max_taps * EQ_MAX_SETS, sizeof(int16_t));
+    int32_t* biquads = (int32_t*)calloc(IIR_MAX_SECTIONS * IIR_BIQUAD_COEFFS * EQ_MAX_SETS,
+                                        sizeof(int32_t));
+    if ((taps == NULL) || (biquads == NULL)) {
+        free(taps);
+        free(biquads);
+        return -ENOMEM;
+    }
+    bool per_channel = false;
+    bool has_taps = false;
+    bool has_biquads = false;
+    bool valid = true;
+    uint32_t set = 0;
+    uint32_t set_taps = 0;
+    uint32_t num_taps = 0;
+    char* line = NULL;
+    size_t len = 0;
+    ssize_t size;
+    while (valid && ((size = getline(&line, &len, fp)) >= 0)) {
+        if ((line[0] == '#') || (size < 2)) {
+            continue;
+        }
+        if (strncmp(line, "@channel", strlen("@channel")) == 0) {
+            if (per_channel || (set_taps > 0)) {
+                valid = eq_text_end_set(set, set_taps, &num_taps);
+                if (++set == EQ_MAX_SETS) {
+                    ALOGE("%s: More than %d channels", __func__, EQ_MAX_SETS);
+                    valid = false;
+                }
+                set_taps = 0;
+            }
+            per_channel = true;
+            continue;
+        }
+        if (strncmp(line, "@biquad", strlen("@biquad")) == 0) {
+            has_biquads = true;
+            if (set_taps == IIR_MAX_SECTIONS) {
+                ALOGE("%s: More than %d biquads", __func__, IIR_MAX_SECTIONS);
+                valid = false;
+            } else if (!eq_text_parse_biquad(
+                               line, &biquads[(set * IIR_MAX_SECTIONS + set_taps) *
+                                              IIR_BIQUAD_COEFFS])) {
+                ALOGE("%s: Invalid biquad %" PRIu32, __func__, set_taps);
+                valid = false;
+            }
+            set_taps++;
+            continue;
+        }
+        has_taps = true;
+        if (set_taps == max_taps) {
+            ALOGI("%s: max tap length %" PRIu32 " reached.", __func__, max_taps);
+            continue;
+        }
+        int16_t* tap = &taps[(size_t)set * max_taps + set_taps];
+        if (sscanf(line, "%" SCNd16, tap) < 1) {
+            ALOGE("%s: Could not find coefficient %" PRIu32, __func__, set_taps);
+            valid = false;
+            break;
+        }
+        ALOGV("Coeff %" PRIu32 ".%" PRIu32 " : %" PRId16, set, set_taps, *tap);
+        set_taps++;
+    }
+    free(line);
+    if (has_taps && has_biquads) {
+        ALOGE("%s: FIR taps and biquads cannot be mixed", __func__);
+        valid = false;
+    }
+    if (valid) {
+        valid = eq_text_end_set(set, set_taps, &num_taps);
+    }
+    if (!valid) {
+        free(taps);
+        free(biquads);
+        return -EINVAL;
+    }
+    uint32_t num_sets = set + 1;
+    if (has_biquads) {
+        size_t set_coeffs = num_taps * IIR_BIQUAD_COEFFS;
+        for (uint32_t i = 1; i < num_sets; i++) {
+            memmove(&biquads[i * set_coeffs], &biquads[i * IIR_MAX_SECTIONS * IIR_BIQUAD_COEFFS],
+                    set_coeffs * sizeof(int32_t));
+        }
+        free(taps);
+        coeffs->type = EQ_TYPE_BIQUAD;
+        coeffs->biquads = biquads;
+        coeffs->parsed = biquads;
+    } else {
+        for (uint32_t i = 1; i < num_sets; i++) {
+            memmove(&taps[i * num_taps], &taps[(size_t)i * max_taps], num_taps * sizeof(int16_t));
+        }
+        free(biquads);
+        coeffs->type = EQ_TYPE_FIR;
+        coeffs->taps = taps;
+        coeffs->parsed = taps;
+    }
+    coeffs->mode = per_channel ? FIR_PER_CHANNEL_FILTER : FIR_SINGLE_FILTER;
+    coeffs->num_sets = num_sets;
+    coeffs->num_taps = num_taps;
+    return 0;
+}
+
+/* Load 'path', whose attributes are in 'st', in either format. */
+static int eq_load(const char* path, const struct stat* st, uint32_t max_taps,
+                   struct eq_coeffs* coeffs) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGI("%s: File %s not found.", __func__, path);
+        return -ENOENT;
+    }
+    uint32_t magic = 0;
+    int ret;
+    if ((st->st_size > (off_t)sizeof(struct eq_coeffs_header)) &&
+        (pread(fd, &magic, sizeof(magic), 0) == sizeof(magic)) && (magic == EQ_COEFFS_MAGIC)) {
+        ret = eq_load_binary(fd, st->st_size, max_taps, coeffs);
+        close(fd);
+    } else {
+        FILE* fp = fdopen(fd, "r");
+        if (fp == NULL) {
+            close(fd);
+            return -errno;
+        }
+        ret = eq_load_text(fp, max_taps, coeffs);
+        fclose(fp);
+    }
+    if (ret == 0) {
+        ALOGI("%s: Loaded %s: %" PRIu32 " set(s) of %" PRIu32 " %s, %s", __func__, path,
+              coeffs->num_sets, coeffs->num_taps,
+              (coeffs->type == EQ_TYPE_BIQUAD) ? "biquads" : "taps",
+              (coeffs->map != NULL) ? "binary" : "text");
+    }
+    return ret;
+}
+
+static bool eq_entry_matches(const struct eq_cache_entry* entry, const char* path,
+                             const struct stat* st) {
+    return entry->valid && (strcmp(entry->path, path) == 0) && (entry->dev == st->st_dev) &&
+           (entry->ino == st->st_ino) && (entry->size == st->st_size) &&
+           (entry->mtime.tv_sec == st->st_mtim.tv_sec) &&
+           (entry->mtime.tv_nsec == st->st_mtim.tv_nsec);
+}
+
+/* Returns the entry for 'path', loading it into the least recently used slot if needed.
+ * Must be called with the cache lock held. */
+static struct eq_cache_entry* eq_cache_lookup(struct eq_cache* cache, const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        ALOGI("%s: File %s not found.", __func__, path);
+        return NULL;
+    }
+    struct eq_cache_entry* victim = &cache->entries[0];
+    for (int i = 0; i < EQ_CACHE_ENTRIES; i++) {
+        struct eq_cache_entry* entry = &cache->entries[i];
+        if (eq_entry_matches(entry, path, &st)) {
+            entry->last_use = ++cache->use_count;
+            return entry;
+        }
+        if (!entry->valid) {
+            victim = entry;
+        } else if (victim->valid && (entry->last_use < victim->last_use)) {
+            victim = entry;
+        }
+    }
+    /* A changed file may still have a stale entry under the same path */
+    for (int i = 0; i < EQ_CACHE_ENTRIES; i++) {
+        if (cache->entries[i].valid && (strcmp(cache->entries[i].path, path) == 0)) {
+            victim = &cache->entries[i];
+        }
+    }
+
+    if (victim->valid) {
+        eq_coeffs_free(&victim->coeffs);
+        victim->valid = false;
+    }
+    if (eq_load(path, &st, cache->max_taps, &victim->coeffs) != 0) {
+        return NULL;
+    }
+    strlcpy(victim->path, path, sizeof(victim->path));
+    victim->dev = st.st_dev;
+    victim->ino = st.st_ino;
+    victim->size = st.st_size;
+    victim->mtime = st.st_mtim;
+    victim->last_use = ++cache->use_count;
+    victim->valid = true;
+    return victim;
+}
+
+struct eq_cache* eq_cache_init(uint32_t max_taps) {
+    struct eq_cache* cache = (struct eq_cache*)calloc(1, sizeof(struct eq_cache));
+    if (cache == NULL) {
+        ALOGE("%s: Unable to allocate memory for EQ cache", __func__);
+        return NULL;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->max_taps = max_taps;
+    return cache;
+}
+
+void eq_cache_release(struct eq_cache* cache) {
+    if (cache == NULL) {
+        return;
+    }
+    for (int i = 0; i < EQ_CACHE_ENTRIES; i++) {
+        if (cache->entries[i].valid) {
+            eq_coeffs_free(&cache->entries[i].coeffs);
+        }
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+eq_filter_t* eq_cache_create_filter(struct eq_cache* cache, const char* path, uint32_t channels,
+                                    fir_sample_format_t sample_format, uint32_t input_length) {
+    eq_filter_t* eq = NULL;
+    pthread_mutex_lock(&cache->lock);
+    struct eq_cache_entry* entry = eq_cache_lookup(cache, path);
+    if (entry == NULL) {
+        goto exit;
+    }
+    const struct eq_coeffs* coeffs = &entry->coeffs;
+    if ((coeffs->mode == FIR_PER_CHANNEL_FILTER) && (coeffs->num_sets != channels)) {
+        ALOGE("%s: %s has %" PRIu32 " coefficient sets for %" PRIu32 " channels", __func__, path,
+              coeffs->num_sets, channels);
+        goto exit;
+    }
+    /* The filters copy their coefficients, so the cache keeps sole ownership of them */
+    if (coeffs->type == EQ_TYPE_BIQUAD) {
+        iir_filter_t* iir = iir_init(channels, coeffs->mode, sample_format, coeffs->num_taps,
+                                     input_length, coeffs->biquads);
+        if (iir != NULL) {
+            eq = eq_filter_init(NULL, iir);
+        }
+    } else {
+        fir_filter_t* fir = fir_init(channels, coeffs->mode, sample_format, coeffs->num_taps,
+                                     input_length, (int16_t*)coeffs->taps);
+        if (fir != NULL) {
+            eq = eq_filter_init(fir, NULL);
+        }
+    }
+exit:
+    pthread_mutex_unlock(&cache->lock);
+    return eq;
+}
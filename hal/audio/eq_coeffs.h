@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * EQ coefficient files and a cache of their parsed contents.
+ *
+ * A file describes either a FIR or a cascade of biquads. Two formats are accepted, told apart
+ * by the first bytes of the file:
+ * - binary: an eq_coeffs_header followed by the coefficients, used in place through mmap;
+ * - text: one Q15 FIR tap per line, or one "@biquad b0 b1 b2 a1 a2" line per section with
+ *   coefficients normalized to a0 = 1, as decimal numbers. '#' starts a comment line. Text files
+ *   are parsed on first load, and biquad coefficients quantized to Q28.
+ *   A line reading "@channel" starts the coefficients of the next channel: a file with such lines
+ *   holds one set per channel (FIR_PER_CHANNEL_FILTER), all of the same length.
+ *
+ * Parsed files are kept in the cache for the life of the device, so streams opening and
+ * closing on the speaker do not touch the file again unless it changes.
+ */
+
+#ifndef EQ_COEFFS_H
+#define EQ_COEFFS_H
+
+#include <stdint.h>
+
+#include "eq_filter.h"
+
+#define EQ_COEFFS_MAGIC 0x51454b59 /* "YKEQ" */
+#define EQ_COEFFS_VERSION 1
+/* Most coefficient sets, i.e. channels, a per-channel file may hold */
+#define EQ_MAX_SETS 8
+
+/* Binary file header, little endian. It is followed by 'num_sets' coefficient sets, one for
+ * FIR_SINGLE_FILTER and one per channel for FIR_PER_CHANNEL_FILTER. A FIR set is 'num_taps' int16
+ * Q15 taps; a biquad set is 'num_taps' sections of IIR_BIQUAD_COEFFS int32 Q28 coefficients. */
+struct eq_coeffs_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t mode;     /* fir_filter_mode_t */
+    uint32_t num_sets;
+    uint32_t num_taps; /* taps or biquad sections per set */
+    uint32_t checksum; /* CRC-32 of the coefficients */
+    uint32_t type;     /* eq_type_t */
+};
+
+struct eq_cache;
+
+/* Create an empty cache. FIR files with more than 'max_taps' taps per set are rejected. */
+struct eq_cache* eq_cache_init(uint32_t max_taps);
+
+void eq_cache_release(struct eq_cache* cache);
+
+/* Build the EQ described by coefficient file 'path' for 'channels' channels, processing up to
+ * 'input_length' frames per call. The parsed file is reused for as long as its size and
+ * modification time do not change.
+ * Returns NULL if the file is missing, empty or invalid. */
+eq_filter_t* eq_cache_create_filter(struct eq_cache* cache, const char* path, uint32_t channels,
+                                     fir_sample_format_t sample_format, uint32_t input_length);
+
+#endif /* #ifndef EQ_COEFFS_H */
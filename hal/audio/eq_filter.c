@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_eq_filter"
+//#define LOG_NDEBUG 0
+
+#include <log/log.h>
+#include <stdlib.h>
+
+#include "eq_filter.h"
+
+eq_filter_t* eq_filter_init(fir_filter_t* fir, iir_filter_t* iir) {
+    if ((fir == NULL) == (iir == NULL)) {
+        ALOGE("%s: Exactly one of FIR and IIR must be set", __func__);
+        goto error;
+    }
+    eq_filter_t* eq = (eq_filter_t*)calloc(1, sizeof(eq_filter_t));
+    if (eq == NULL) {
+        ALOGE("%s: Unable to allocate memory for eq_filter.", __func__);
+        goto error;
+    }
+    eq->type = (fir != NULL) ? EQ_TYPE_FIR : EQ_TYPE_BIQUAD;
+    eq->fir = fir;
+    eq->iir = iir;
+    return eq;
+
+error:
+    fir_release(fir);
+    iir_release(iir);
+    return NULL;
+}
+
+void eq_filter_release(eq_filter_t* eq) {
+    if (eq == NULL) {
+        return;
+    }
+    fir_release(eq->fir);
+    iir_release(eq->iir);
+    free(eq);
+}
+
+void eq_filter_reset(eq_filter_t* eq) {
+    if (eq == NULL) {
+        return;
+    }
+    fir_reset(eq->fir);
+    iir_reset(eq->iir);
+}
+
+void eq_filter_set_reduced(eq_filter_t* eq, bool reduced) {
+    if ((eq == NULL) || (eq->type != EQ_TYPE_FIR)) {
+        return;
+    }
+    uint32_t length = eq->fir->filter_length;
+    fir_set_active_length(eq->fir, reduced ? length / EQ_REDUCED_FIR_DIVISOR : length);
+}
+
+void eq_filter_process_interleaved(eq_filter_t* eq, int16_t* input, int16_t* output,
+                                   uint32_t samples, const gain_segment_t* gain) {
+    if (eq->type == EQ_TYPE_BIQUAD) {
+        iir_process_interleaved(eq->iir, input, output, samples, gain);
+    } else {
+        fir_process_interleaved(eq->fir, input, output, samples, gain);
+    }
+}
+
+int32_t* eq_filter_get_input_q31(eq_filter_t* eq) {
+    return (eq->type == EQ_TYPE_BIQUAD) ? iir_get_input_q31(eq->iir) : fir_get_input_q31(eq->fir);
+}
+
+void eq_filter_process_interleaved_q31(eq_filter_t* eq, int32_t* output, uint32_t samples,
+                                       const gain_segment_t* gain) {
+    if (eq->type == EQ_TYPE_BIQUAD) {
+        iir_process_interleaved_q31(eq->iir, output, samples, gain);
+    } else {
+        fir_process_interleaved_q31(eq->fir, output, samples, gain);
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Speaker EQ: either a FIR or a biquad cascade, picked by the EQ configuration. Both share the
+ * same processing API, so the output path does not care which one it runs.
+ */
+
+#ifndef EQ_FILTER_H
+#define EQ_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fir_filter.h"
+#include "gain_ramp.h"
+#include "iir_filter.h"
+
+/* A reduced FIR only runs this fraction of its taps */
+#define EQ_REDUCED_FIR_DIVISOR 4
+
+typedef enum eq_type { EQ_TYPE_FIR = 0, EQ_TYPE_BIQUAD } eq_type_t;
+
+typedef struct eq_filter {
+    eq_type_t type;
+    fir_filter_t* fir; /* EQ_TYPE_FIR */
+    iir_filter_t* iir; /* EQ_TYPE_BIQUAD */
+} eq_filter_t;
+
+/* Wrap 'fir' or 'iir', whichever is not NULL. Takes ownership; returns NULL on failure. */
+eq_filter_t* eq_filter_init(fir_filter_t* fir, iir_filter_t* iir);
+void eq_filter_release(eq_filter_t* eq);
+void eq_filter_reset(eq_filter_t* eq);
+/* Trade accuracy for CPU: a FIR drops the tail of its response. A biquad cascade is already
+ * cheap and is left as is. */
+void eq_filter_set_reduced(eq_filter_t* eq, bool reduced);
+void eq_filter_process_interleaved(eq_filter_t* eq, int16_t* input, int16_t* output,
+                                   uint32_t samples, const gain_segment_t* gain);
+int32_t* eq_filter_get_input_q31(eq_filter_t* eq);
+void eq_filter_process_interleaved_q31(eq_filter_t* eq, int32_t* output, uint32_t samples,
+                                       const gain_segment_t* gain);
+
+#endif /* #ifndef EQ_FILTER_H */
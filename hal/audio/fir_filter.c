@@ -26,19 +26,20 @@
 #include <string.h>
 
 #include "fir_filter.h"
+#include "rt_support.h"
 
 #ifdef __ARM_NEON
 #include "arm_neon.h"
 #endif /* #ifdef __ARM_NEON */
 
-fir_filter_t* fir_init(uint32_t channels, fir_filter_mode_t mode, uint32_t filter_length,
-                       uint32_t input_length, int16_t* coeffs) {
+fir_filter_t* fir_init(uint32_t channels, fir_filter_mode_t mode, fir_sample_format_t sample_format,
+                       uint32_t filter_length, uint32_t input_length, int16_t* coeffs) {
     if ((channels == 0) || (filter_length == 0) || (coeffs == NULL)) {
         ALOGE("%s: Invalid channel count, filter length or coefficient array.", __func__);
         return NULL;
     }
 
-    fir_filter_t* fir = (fir_filter_t*)calloc(1, sizeof(fir_filter_t));
+    fir_filter_t* fir = (fir_filter_t*)rt_heap_calloc(1, sizeof(fir_filter_t));
     if (fir == NULL) {
         ALOGE("%s: Unable to allocate memory for fir_filter.", __func__);
         return NULL;
@@ -46,24 +47,44 @@ fir_filter_t* fir_init(uint32_t channels, fir_filter_mode_t mode, uint32_t filte
 
     fir->channels = channels;
     fir->filter_length = filter_length;
+    fir->active_length = filter_length;
+    fir->sample_format = sample_format;
     /* Default: same filter coeffs for all channels */
-    fir->mode = FIR_SINGLE_FILTER;
-    uint32_t coeff_bytes = fir->filter_length * sizeof(int16_t);
-    if (mode == FIR_PER_CHANNEL_FILTER) {
-        fir->mode = FIR_PER_CHANNEL_FILTER;
-        coeff_bytes = fir->filter_length * fir->channels * sizeof(int16_t);
+    fir->mode = (mode == FIR_PER_CHANNEL_FILTER) ? FIR_PER_CHANNEL_FILTER : FIR_SINGLE_FILTER;
+    fir->coeff_stride = (channels + FIR_LANES - 1) / FIR_LANES * FIR_LANES;
+
+    size_t num_coeffs = (size_t)fir->filter_length * fir->coeff_stride;
+    if (fir->sample_format == FIR_SAMPLES_Q31) {
+        fir->coeffs_q31 = (int32_t*)rt_heap_calloc(num_coeffs, sizeof(int32_t));
+    } else {
+        fir->coeffs = (int16_t*)rt_heap_calloc(num_coeffs, sizeof(int16_t));
     }
-
-    fir->coeffs = (int16_t*)malloc(coeff_bytes);
-    if (fir->coeffs == NULL) {
+    if ((fir->coeffs == NULL) && (fir->coeffs_q31 == NULL)) {
         ALOGE("%s: Unable to allocate memory for FIR coeffs", __func__);
         goto exit_1;
     }
-    memcpy(fir->coeffs, coeffs, coeff_bytes);
+    for (uint32_t k = 0; k < fir->filter_length; k++) {
+        for (uint32_t ch = 0; ch < fir->channels; ch++) {
+            int16_t coeff = (fir->mode == FIR_PER_CHANNEL_FILTER)
+                                    ? coeffs[ch * fir->filter_length + k]
+                                    : coeffs[k];
+            if (fir->coeffs_q31 != NULL) {
+                fir->coeffs_q31[k * fir->coeff_stride + ch] = coeff;
+            } else {
+                fir->coeffs[k * fir->coeff_stride + ch] = coeff;
+            }
+        }
+    }
 
+    /* The last SIMD block of a frame may read up to FIR_LANES - 1 samples past the history */
     fir->buffer_size = (input_length + fir->filter_length) * fir->channels;
-    fir->state = (int16_t*)malloc(fir->buffer_size * sizeof(int16_t));
-    if (fir->state == NULL) {
+    size_t alloc_samples = fir->buffer_size + FIR_LANES;
+    if (fir->sample_format == FIR_SAMPLES_Q31) {
+        fir->state_q31 = (int32_t*)rt_heap_calloc(alloc_samples, sizeof(int32_t));
+    } else {
+        fir->state = (int16_t*)rt_heap_calloc(alloc_samples, sizeof(int16_t));
+    }
+    if ((fir->state == NULL) && (fir->state_q31 == NULL)) {
         ALOGE("%s: Unable to allocate memory for FIR state", __func__);
         goto exit_2;
     }
@@ -76,9 +97,10 @@ fir_filter_t* fir_init(uint32_t channels, fir_filter_mode_t mode, uint32_t filte
     return fir;
 
 exit_2:
-    free(fir->coeffs);
+    rt_heap_free(fir->coeffs);
+    rt_heap_free(fir->coeffs_q31);
 exit_1:
-    free(fir);
+    rt_heap_free(fir);
     return NULL;
 }
 
@@ -86,69 +108,147 @@ void fir_release(fir_filter_t* fir) {
     if (fir == NULL) {
         return;
     }
-    free(fir->state);
-    free(fir->coeffs);
-    free(fir);
+    rt_heap_free(fir->state);
+    rt_heap_free(fir->state_q31);
+    rt_heap_free(fir->coeffs);
+    rt_heap_free(fir->coeffs_q31);
+    rt_heap_free(fir);
 }
 
 void fir_reset(fir_filter_t* fir) {
     if (fir == NULL) {
         return;
     }
-    memset(fir->state, 0, fir->buffer_size * sizeof(int16_t));
+    if (fir->state_q31 != NULL) {
+        memset(fir->state_q31, 0, fir->buffer_size * sizeof(int32_t));
+    } else {
+        memset(fir->state, 0, fir->buffer_size * sizeof(int16_t));
+    }
 }
 
-void fir_process_interleaved(fir_filter_t* fir, int16_t* input, int16_t* output, uint32_t samples) {
-    assert(fir != NULL);
-
-    int start_offset = (fir->filter_length - 1) * fir->channels;
-    memcpy(&fir->state[start_offset], input, samples * fir->channels * sizeof(int16_t));
-    // int ch;
-    bool use_2nd_set_coeffs = (fir->channels > 1) && (fir->mode == FIR_PER_CHANNEL_FILTER);
-    int16_t* p_coeff_A = &fir->coeffs[0];
-    int16_t* p_coeff_B = use_2nd_set_coeffs ? &fir->coeffs[fir->filter_length] : &fir->coeffs[0];
-    int16_t* p_output;
-    for (int ch = 0; ch < fir->channels; ch += 2) {
-        p_output = &output[ch];
-        int offset = start_offset + ch;
-        for (int s = 0; s < samples; s++) {
-            int32_t acc_A = 0;
-            int32_t acc_B = 0;
+void fir_set_active_length(fir_filter_t* fir, uint32_t length) {
+    if (fir == NULL) {
+        return;
+    }
+    if (length == 0) {
+        length = 1;
+    } else if (length > fir->filter_length) {
+        length = fir->filter_length;
+    }
+    fir->active_length = length;
+}
+
+void fir_process_interleaved(fir_filter_t* fir, int16_t* input, int16_t* output, uint32_t samples,
+                             const gain_segment_t* gain) {
+    assert((fir != NULL) && (fir->state != NULL));
+
+    const uint32_t channels = fir->channels;
+    int start_offset = (fir->filter_length - 1) * channels;
+    memcpy(&fir->state[start_offset], input, samples * channels * sizeof(int16_t));
+    if ((gain != NULL) && gain_segment_is_silent(gain)) {
+        /* Muted: only keep the history up to date */
+        memset(output, 0, samples * channels * sizeof(int16_t));
+        goto exit;
+    }
+    bool apply_gain = (gain != NULL) && !gain_segment_is_unity(gain);
+
+    for (uint32_t s = 0; s < samples; s++) {
+        int16_t* p_output = &output[s * channels];
+        int64_t g = apply_gain ? gain_segment_at(gain, s) : GAIN_UNITY;
+        for (uint32_t ch = 0; ch < channels; ch += FIR_LANES) {
+            /* Newest frame first, walking back one frame per tap */
+            const int16_t* p_state = &fir->state[start_offset + s * channels + ch];
+            const int16_t* p_coeff = &fir->coeffs[ch];
+            uint32_t lanes = (channels - ch < FIR_LANES) ? channels - ch : FIR_LANES;
+            int32_t acc[FIR_LANES] = {0};
 
 #ifdef __ARM_NEON
             int32x4_t acc_vec = vdupq_n_s32(0);
-            for (int k = 0; k < fir->filter_length; k++, offset -= fir->channels) {
-                int16x4_t coeff_vec = vdup_n_s16(p_coeff_A[k]);
-                coeff_vec = vset_lane_s16(p_coeff_B[k], coeff_vec, 1);
-                int16x4_t input_vec = vld1_s16(&fir->state[offset]);
-                acc_vec = vmlal_s16(acc_vec, coeff_vec, input_vec);
+            for (uint32_t k = 0; k < fir->active_length;
+                 k++, p_state -= channels, p_coeff += fir->coeff_stride) {
+                acc_vec = vmlal_s16(acc_vec, vld1_s16(p_coeff), vld1_s16(p_state));
             }
-            acc_A = vgetq_lane_s32(acc_vec, 0);
-            acc_B = vgetq_lane_s32(acc_vec, 1);
+            vst1q_s32(acc, acc_vec);
 #else
-            for (int k = 0; k < fir->filter_length; k++, offset -= fir->channels) {
-                int32_t input_A = (int32_t)(fir->state[offset]);
-                int32_t coeff_A = (int32_t)(p_coeff_A[k]);
-                int32_t input_B = (int32_t)(fir->state[offset + 1]);
-                int32_t coeff_B = (int32_t)(p_coeff_B[k]);
-                acc_A += (input_A * coeff_A);
-                acc_B += (input_B * coeff_B);
+            for (uint32_t k = 0; k < fir->active_length;
+                 k++, p_state -= channels, p_coeff += fir->coeff_stride) {
+                for (uint32_t l = 0; l < lanes; l++) {
+                    acc[l] += (int32_t)p_state[l] * (int32_t)p_coeff[l];
+                }
             }
 #endif /* #ifdef __ARM_NEON */
 
-            *p_output = clamp16(acc_A >> 15);
-            if (ch < fir->channels - 1) {
-                *(p_output + 1) = clamp16(acc_B >> 15);
+            for (uint32_t l = 0; l < lanes; l++) {
+                /* Q30 accumulator, times Q30 gain if any */
+                p_output[ch + l] = apply_gain ? clamp16((int32_t)((acc[l] * g) >> 45))
+                                              : clamp16(acc[l] >> 15);
             }
-            /* Move to next sample */
-            p_output += fir->channels;
-            offset += (fir->filter_length + 1) * fir->channels;
         }
-        if (use_2nd_set_coeffs) {
-            p_coeff_A += (fir->filter_length << 1);
-            p_coeff_B += (fir->filter_length << 1);
+    }
+exit:
+    memmove(fir->state, &fir->state[samples * channels],
+            (fir->filter_length - 1) * channels * sizeof(int16_t));
+}
+
+int32_t* fir_get_input_q31(fir_filter_t* fir) {
+    assert((fir != NULL) && (fir->state_q31 != NULL));
+    return &fir->state_q31[(fir->filter_length - 1) * fir->channels];
+}
+
+void fir_process_interleaved_q31(fir_filter_t* fir, int32_t* output, uint32_t samples,
+                                 const gain_segment_t* gain) {
+    assert((fir != NULL) && (fir->state_q31 != NULL));
+
+    const uint32_t channels = fir->channels;
+    int start_offset = (fir->filter_length - 1) * channels;
+    if ((gain != NULL) && gain_segment_is_silent(gain)) {
+        memset(output, 0, samples * channels * sizeof(int32_t));
+        goto exit;
+    }
+    bool apply_gain = (gain != NULL) && !gain_segment_is_unity(gain);
+
+    for (uint32_t s = 0; s < samples; s++) {
+        int32_t* p_output = &output[s * channels];
+        int64_t g = apply_gain ? gain_segment_at(gain, s) : GAIN_UNITY;
+        for (uint32_t ch = 0; ch < channels; ch += FIR_LANES) {
+            const int32_t* p_state = &fir->state_q31[start_offset + s * channels + ch];
+            const int32_t* p_coeff = &fir->coeffs_q31[ch];
+            uint32_t lanes = (channels - ch < FIR_LANES) ? channels - ch : FIR_LANES;
+            int64_t acc[FIR_LANES] = {0};
+
+#ifdef __ARM_NEON
+            /* Two 64-bit accumulators per FIR_LANES block */
+            int64x2_t acc_lo = vdupq_n_s64(0);
+            int64x2_t acc_hi = vdupq_n_s64(0);
+            for (uint32_t k = 0; k < fir->active_length;
+                 k++, p_state -= channels, p_coeff += fir->coeff_stride) {
+                int32x4_t coeff_vec = vld1q_s32(p_coeff);
+                int32x4_t input_vec = vld1q_s32(p_state);
+                acc_lo = vmlal_s32(acc_lo, vget_low_s32(coeff_vec), vget_low_s32(input_vec));
+                acc_hi = vmlal_s32(acc_hi, vget_high_s32(coeff_vec), vget_high_s32(input_vec));
+            }
+            vst1q_s64(&acc[0], acc_lo);
+            vst1q_s64(&acc[2], acc_hi);
+#else
+            for (uint32_t k = 0; k < fir->active_length;
+                 k++, p_state -= channels, p_coeff += fir->coeff_stride) {
+                for (uint32_t l = 0; l < lanes; l++) {
+                    acc[l] += (int64_t)p_state[l] * (int64_t)p_coeff[l];
+                }
+            }
+#endif /* #ifdef __ARM_NEON */
+
+            for (uint32_t l = 0; l < lanes; l++) {
+                /* Q46 accumulator back to Q31, then Q30 gain if any */
+                int64_t sample = acc[l] >> 15;
+                if (apply_gain) {
+                    sample = (int64_t)clamp32(sample) * g >> 30;
+                }
+                p_output[ch + l] = clamp32(sample);
+            }
         }
     }
-    memmove(fir->state, &fir->state[samples * fir->channels],
-            (fir->filter_length - 1) * fir->channels * sizeof(int16_t));
+exit:
+    memmove(fir->state_q31, &fir->state_q31[samples * channels],
+            (fir->filter_length - 1) * channels * sizeof(int32_t));
 }
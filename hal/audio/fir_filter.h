@@ -19,21 +19,52 @@
 
 #include <stdint.h>
 
+#include "gain_ramp.h"
+
 typedef enum fir_filter_mode { FIR_SINGLE_FILTER = 0, FIR_PER_CHANNEL_FILTER } fir_filter_mode_t;
 
+/* Sample format the filter runs on. Coefficients are Q15 in both cases; Q31 samples are
+ * accumulated in 64 bits so high resolution input keeps its precision through the EQ. */
+typedef enum fir_sample_format { FIR_SAMPLES_I16 = 0, FIR_SAMPLES_Q31 } fir_sample_format_t;
+
+/* Channels processed together by one SIMD accumulator block. */
+#define FIR_LANES 4
+
+/* Any interleaved channel count is supported. Coefficients are stored tap-major with
+ * 'coeff_stride' (channels rounded up to FIR_LANES, zero padded) entries per tap, so the kernels
+ * vectorize across the channels of a frame. */
 typedef struct fir_filter {
     fir_filter_mode_t mode;
+    fir_sample_format_t sample_format;
     uint32_t channels;
     uint32_t filter_length;
+    uint32_t active_length; /* leading taps actually run, see fir_set_active_length() */
     uint32_t buffer_size;
-    int16_t* coeffs;
-    int16_t* state;
+    uint32_t coeff_stride;
+    int16_t* coeffs;     /* FIR_SAMPLES_I16 taps */
+    int32_t* coeffs_q31; /* FIR_SAMPLES_Q31 taps, Q15 values widened for 32-bit lanes */
+    int16_t* state;      /* FIR_SAMPLES_I16 history */
+    int32_t* state_q31;  /* FIR_SAMPLES_Q31 history */
 } fir_filter_t;
 
-fir_filter_t* fir_init(uint32_t channels, fir_filter_mode_t mode, uint32_t filter_length,
-                       uint32_t input_length, int16_t* coeffs);
+/* 'coeffs' holds 'filter_length' taps, or 'channels' consecutive sets of them with
+ * FIR_PER_CHANNEL_FILTER. */
+fir_filter_t* fir_init(uint32_t channels, fir_filter_mode_t mode, fir_sample_format_t sample_format,
+                       uint32_t filter_length, uint32_t input_length, int16_t* coeffs);
 void fir_release(fir_filter_t* fir);
 void fir_reset(fir_filter_t* fir);
-void fir_process_interleaved(fir_filter_t* fir, int16_t* input, int16_t* output, uint32_t samples);
+/* Only run the first 'length' taps, clamped to [1, filter_length], as a cheaper approximation
+ * under load. The full history is kept so the whole filter can be restored at any time. */
+void fir_set_active_length(fir_filter_t* fir, uint32_t length);
+/* 'gain', if not NULL, is applied in the output stage. */
+void fir_process_interleaved(fir_filter_t* fir, int16_t* input, int16_t* output, uint32_t samples,
+                             const gain_segment_t* gain);
+
+/* Q31 processing is split in two so input can be converted straight into the filter history:
+ * write 'samples' interleaved frames at fir_get_input_q31(), then call
+ * fir_process_interleaved_q31(). */
+int32_t* fir_get_input_q31(fir_filter_t* fir);
+void fir_process_interleaved_q31(fir_filter_t* fir, int32_t* output, uint32_t samples,
+                                 const gain_segment_t* gain);
 
 #endif /* #ifndef FIR_FILTER_H */
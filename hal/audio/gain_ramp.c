@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_gain_ramp"
+//#define LOG_NDEBUG 0
+
+#include <audio_utils/primitives.h>
+#include <string.h>
+
+#include "gain_ramp.h"
+
+#ifdef __ARM_NEON
+#include "arm_neon.h"
+#endif /* #ifdef __ARM_NEON */
+
+int32_t gain_from_float(float volume) {
+    if (!(volume > 0.0f)) {
+        return 0;
+    }
+    if (volume >= 1.0f) {
+        return GAIN_UNITY;
+    }
+    return (int32_t)((double)volume * GAIN_UNITY + 0.5);
+}
+
+void gain_ramp_init(gain_ramp_t* ramp, int32_t gain, uint32_t ramp_frames) {
+    ramp->current = gain;
+    ramp->target = gain;
+    ramp->step = 0;
+    ramp->remaining = 0;
+    ramp->ramp_frames = (ramp_frames > 0) ? ramp_frames : 1;
+}
+
+void gain_ramp_next(gain_ramp_t* ramp, int32_t target, uint32_t frames, gain_segment_t* segment) {
+    if (target != ramp->target) {
+        ramp->target = target;
+        ramp->step = (target - ramp->current) / (int32_t)ramp->ramp_frames;
+        ramp->remaining = (ramp->step != 0) ? ramp->ramp_frames : 0;
+        if (ramp->remaining == 0) {
+            ramp->current = target;
+        }
+    }
+
+    uint32_t ramp_frames = (ramp->remaining < frames) ? ramp->remaining : frames;
+    segment->start = ramp->current;
+    segment->step = ramp->step;
+    segment->ramp_frames = ramp_frames;
+    segment->end = ramp->target;
+
+    ramp->remaining -= ramp_frames;
+    /* Snap to the target at the end of the ramp, integer steps may fall short of it */
+    ramp->current = (ramp->remaining == 0) ? ramp->target
+                                           : ramp->current + ramp->step * (int32_t)ramp_frames;
+}
+
+void gain_crossfade_segments(uint32_t frames, gain_segment_t* fade_in, gain_segment_t* fade_out) {
+    int32_t step = GAIN_UNITY / (int32_t)((frames > 0) ? frames : 1);
+    fade_in->start = 0;
+    fade_in->step = step;
+    fade_in->ramp_frames = frames;
+    fade_in->end = GAIN_UNITY;
+    fade_out->start = GAIN_UNITY;
+    fade_out->step = -step;
+    fade_out->ramp_frames = frames;
+    fade_out->end = 0;
+}
+
+static void gain_ramp_i16(int16_t* buffer, uint32_t channels, const gain_segment_t* segment) {
+    for (uint32_t n = 0; n < segment->ramp_frames; n++) {
+        int64_t gain = gain_segment_at(segment, n);
+        for (uint32_t ch = 0; ch < channels; ch++, buffer++) {
+            *buffer = clamp16((int32_t)((*buffer * gain) >> 30));
+        }
+    }
+}
+
+void gain_apply_i16(int16_t* buffer, uint32_t channels, uint32_t frames,
+                    const gain_segment_t* segment) {
+    gain_ramp_i16(buffer, channels, segment);
+
+    /* Constant gain for the remainder */
+    size_t samples = (size_t)(frames - segment->ramp_frames) * channels;
+    int16_t* p = &buffer[segment->ramp_frames * channels];
+    if (segment->end == GAIN_UNITY) {
+        return;
+    }
+    if (segment->end == 0) {
+        memset(p, 0, samples * sizeof(int16_t));
+        return;
+    }
+    /* Below unity, so it fits Q15 */
+    int16_t gain_q15 = (int16_t)(segment->end >> 15);
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 8 <= samples; i += 8) {
+        vst1q_s16(&p[i], vqrdmulhq_n_s16(vld1q_s16(&p[i]), gain_q15));
+    }
+#endif /* #ifdef __ARM_NEON */
+    for (; i < samples; i++) {
+        p[i] = clamp16((p[i] * gain_q15 + (1 << 14)) >> 15);
+    }
+}
+
+static void gain_ramp_q31(int32_t* buffer, uint32_t channels, const gain_segment_t* segment) {
+    for (uint32_t n = 0; n < segment->ramp_frames; n++) {
+        int64_t gain = gain_segment_at(segment, n);
+        for (uint32_t ch = 0; ch < channels; ch++, buffer++) {
+            *buffer = clamp32((*buffer * gain) >> 30);
+        }
+    }
+}
+
+void gain_apply_q31(int32_t* buffer, uint32_t channels, uint32_t frames,
+                    const gain_segment_t* segment) {
+    gain_ramp_q31(buffer, channels, segment);
+
+    size_t samples = (size_t)(frames - segment->ramp_frames) * channels;
+    int32_t* p = &buffer[segment->ramp_frames * channels];
+    if (segment->end == GAIN_UNITY) {
+        return;
+    }
+    if (segment->end == 0) {
+        memset(p, 0, samples * sizeof(int32_t));
+        return;
+    }
+    int32_t gain_q31 = segment->end << 1;
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 4 <= samples; i += 4) {
+        vst1q_s32(&p[i], vqrdmulhq_n_s32(vld1q_s32(&p[i]), gain_q31));
+    }
+#endif /* #ifdef __ARM_NEON */
+    for (; i < samples; i++) {
+        p[i] = clamp32(((int64_t)p[i] * gain_q31 + (1LL << 30)) >> 31);
+    }
+}
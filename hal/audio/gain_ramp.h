@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Output gain with linear ramps. Gains are Q30 so unity is exactly representable; a change of
+ * target is spread over a fixed number of frames to avoid zipper noise.
+ */
+
+#ifndef GAIN_RAMP_H
+#define GAIN_RAMP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GAIN_UNITY (1 << 30)
+
+/* Gain over one buffer: frame n gets 'start + n * step' for n < 'ramp_frames', 'end' after. */
+typedef struct gain_segment {
+    int32_t start;
+    int32_t step;
+    uint32_t ramp_frames;
+    int32_t end;
+} gain_segment_t;
+
+typedef struct gain_ramp {
+    int32_t current;
+    int32_t target;
+    int32_t step;
+    uint32_t remaining; /* frames left in the ramp in progress */
+    uint32_t ramp_frames;
+} gain_ramp_t;
+
+static inline int32_t gain_segment_at(const gain_segment_t* segment, uint32_t frame) {
+    return (frame < segment->ramp_frames) ? segment->start + segment->step * (int32_t)frame
+                                          : segment->end;
+}
+
+static inline bool gain_segment_is_unity(const gain_segment_t* segment) {
+    return (segment->ramp_frames == 0) && (segment->end == GAIN_UNITY);
+}
+
+static inline bool gain_segment_is_silent(const gain_segment_t* segment) {
+    return (segment->ramp_frames == 0) && (segment->end == 0);
+}
+
+/* Convert a [0.0, 1.0] volume to a Q30 gain. */
+int32_t gain_from_float(float volume);
+
+/* Start at 'gain' with no ramp in progress. Target changes take 'ramp_frames' frames. */
+void gain_ramp_init(gain_ramp_t* ramp, int32_t gain, uint32_t ramp_frames);
+
+/* Describe in 'segment' the gain for the next 'frames' frames heading to 'target', and advance
+ * the ramp past them. A new target restarts the ramp from the current gain. */
+void gain_ramp_next(gain_ramp_t* ramp, int32_t target, uint32_t frames, gain_segment_t* segment);
+
+/* Linear fade in and fade out over exactly 'frames' frames, summing to unity. */
+void gain_crossfade_segments(uint32_t frames, gain_segment_t* fade_in, gain_segment_t* fade_out);
+
+/* Apply 'segment' in place to 'frames' interleaved frames of 'channels' channels. */
+void gain_apply_i16(int16_t* buffer, uint32_t channels, uint32_t frames,
+                    const gain_segment_t* segment);
+void gain_apply_q31(int32_t* buffer, uint32_t channels, uint32_t frames,
+                    const gain_segment_t* segment);
+
+#endif /* #ifndef GAIN_RAMP_H */
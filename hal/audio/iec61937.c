@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_iec61937"
+//#define LOG_NDEBUG 0
+
+#include <log/log.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iec61937.h"
+#include "rt_support.h"
+
+#define IEC61937_PA 0xf872
+#define IEC61937_PB 0x4e1f
+#define IEC61937_TYPE_AC3 0x01
+#define IEC61937_TYPE_EAC3 0x15
+
+#define AC3_SYNC_0 0x0b
+#define AC3_SYNC_1 0x77
+/* Bytes of the syncinfo and bsi needed to size a frame */
+#define AC3_HEADER_BYTES 6
+#define AC3_BLOCKS_PER_FRAME 6
+
+/* AC3 bit rates in kbit/s by frmsizecod / 2. A 48 kHz frame is two words per kbit/s. */
+static const uint16_t kAc3BitRates[] = {32,  40,  48,  56,  64,  80,  96,  112, 128, 160,
+                                        192, 224, 256, 320, 384, 448, 512, 576, 640};
+static const uint8_t kEac3Blocks[] = {1, 2, 3, 6};
+
+iec61937_t* iec61937_init(iec61937_codec_t codec) {
+    iec61937_t* iec = (iec61937_t*)rt_heap_calloc(1, sizeof(iec61937_t));
+    if (iec == NULL) {
+        ALOGE("%s: Unable to allocate memory for IEC 61937 framer.", __func__);
+        return NULL;
+    }
+    iec->codec = codec;
+    iec->transport_rate = (codec == IEC61937_EAC3) ? 192000 : 48000;
+    iec->burst_bytes = (codec == IEC61937_EAC3) ? IEC61937_EAC3_BURST_BYTES
+                                                : IEC61937_AC3_BURST_BYTES;
+    iec->burst = (uint8_t*)rt_heap_calloc(iec->burst_bytes, 1);
+    if (iec->burst == NULL) {
+        ALOGE("%s: Unable to allocate memory for IEC 61937 burst.", __func__);
+        rt_heap_free(iec);
+        return NULL;
+    }
+    return iec;
+}
+
+void iec61937_release(iec61937_t* iec) {
+    if (iec == NULL) {
+        return;
+    }
+    rt_heap_free(iec->burst);
+    rt_heap_free(iec);
+}
+
+void iec61937_reset(iec61937_t* iec) {
+    if (iec == NULL) {
+        return;
+    }
+    iec->payload_bytes = 0;
+    iec->blocks = 0;
+    iec->header_fill = 0;
+    iec->frame_bytes = 0;
+    iec->frame_fill = 0;
+}
+
+static void put_word(uint8_t* dst, uint16_t word) {
+    dst[0] = word & 0xff;
+    dst[1] = word >> 8;
+}
+
+/* Size of the frame starting with 'header', 0 if it is not a frame we can carry. E-AC3 frames
+ * also report their audio blocks, 0 for dependent substreams which add none. */
+static size_t iec61937_parse_header(iec61937_t* iec, const uint8_t* header, uint32_t* blocks,
+                                    bool* independent) {
+    if ((header[0] != AC3_SYNC_0) || (header[1] != AC3_SYNC_1)) {
+        return 0;
+    }
+    uint8_t fscod = header[4] >> 6;
+    uint8_t bsid = header[5] >> 3;
+    if (iec->codec == IEC61937_AC3) {
+        uint8_t frmsizecod = header[4] & 0x3f;
+        if ((bsid > 10) || (fscod != 0) || ((frmsizecod >> 1) >= (sizeof(kAc3BitRates) /
+                                                                  sizeof(kAc3BitRates[0])))) {
+            return 0;
+        }
+        iec->bsmod = header[5] & 0x07;
+        *blocks = AC3_BLOCKS_PER_FRAME;
+        *independent = true;
+        return (size_t)kAc3BitRates[frmsizecod >> 1] * 2 * sizeof(uint16_t);
+    }
+
+    /* E-AC3: strmtyp(2) substreamid(3) frmsiz(11) fscod(2) numblkscod(2) ... bsid(5) */
+    if ((bsid <= 10) || (bsid > 16) || (fscod != 0)) {
+        return 0;
+    }
+    uint8_t strmtyp = header[2] >> 6;
+    *independent = (strmtyp != 1);
+    *blocks = *independent ? kEac3Blocks[(header[4] >> 4) & 0x03] : 0;
+    return ((((size_t)header[2] & 0x07) << 8 | header[3]) + 1) * sizeof(uint16_t);
+}
+
+/* Fill in the preamble and padding of the burst in iec->burst and start a new one. */
+static const uint8_t* iec61937_finish_burst(iec61937_t* iec) {
+    uint16_t type = (iec->codec == IEC61937_EAC3) ? IEC61937_TYPE_EAC3
+                                                  : (IEC61937_TYPE_AC3 | (iec->bsmod << 8));
+    /* Pd is the payload length in bits for AC3, in bytes for E-AC3 */
+    size_t length = (iec->codec == IEC61937_EAC3) ? iec->payload_bytes : iec->payload_bytes * 8;
+    put_word(&iec->burst[0], IEC61937_PA);
+    put_word(&iec->burst[2], IEC61937_PB);
+    put_word(&iec->burst[4], type);
+    put_word(&iec->burst[6], (uint16_t)length);
+    memset(&iec->burst[IEC61937_PREAMBLE_BYTES + iec->payload_bytes], 0,
+           iec->burst_bytes - IEC61937_PREAMBLE_BYTES - iec->payload_bytes);
+    iec->payload_bytes = 0;
+    iec->blocks = 0;
+    iec->bursts++;
+    return iec->burst;
+}
+
+/* Append coded bytes to the payload, swapping each pair into a little endian 16-bit sample.
+ * Frames are a whole number of words, so the payload always starts a frame word aligned. */
+static void iec61937_append(iec61937_t* iec, const uint8_t* data, size_t bytes) {
+    uint8_t* payload = &iec->burst[IEC61937_PREAMBLE_BYTES];
+    size_t pos = iec->payload_bytes;
+    for (size_t i = 0; i < bytes; i++, pos++) {
+        payload[pos ^ 1] = data[i];
+    }
+    iec->payload_bytes = pos;
+}
+
+size_t iec61937_feed(iec61937_t* iec, const uint8_t* data, size_t bytes, const uint8_t** burst) {
+    const size_t max_payload = iec->burst_bytes - IEC61937_PREAMBLE_BYTES;
+    size_t done = 0;
+    *burst = NULL;
+
+    while (done < bytes) {
+        if (iec->header_fill < AC3_HEADER_BYTES) {
+            /* Hunt for the sync word, then gather enough of the header to size the frame */
+            if ((iec->header_fill == 0) && (data[done] != AC3_SYNC_0)) {
+                done++;
+                continue;
+            }
+            iec->header[iec->header_fill++] = data[done++];
+            if ((iec->header_fill == 2) && (iec->header[1] != AC3_SYNC_1)) {
+                iec->header_fill = 0;
+            }
+            continue;
+        }
+
+        if (iec->frame_bytes == 0) {
+            uint32_t blocks = 0;
+            bool independent = true;
+            size_t frame_bytes = iec61937_parse_header(iec, iec->header, &blocks, &independent);
+            if ((frame_bytes < AC3_HEADER_BYTES) || (frame_bytes > max_payload)) {
+                ALOGV("%s: invalid frame header, resyncing", __func__);
+                iec->sync_losses++;
+                iec->header_fill = 0;
+                continue;
+            }
+            if ((iec->codec == IEC61937_EAC3) && independent &&
+                (iec->blocks >= AC3_BLOCKS_PER_FRAME)) {
+                /* This frame starts the next burst: hand over the current one first, the
+                 * header is kept and parsed again on the next call. */
+                *burst = iec61937_finish_burst(iec);
+                return done;
+            }
+            if (iec->payload_bytes + frame_bytes > max_payload) {
+                ALOGW("%s: burst overflow, dropping %zu bytes", __func__, iec->payload_bytes);
+                iec->sync_losses++;
+                iec->payload_bytes = 0;
+                iec->blocks = 0;
+            }
+            iec->frame_bytes = frame_bytes;
+            iec->frame_fill = AC3_HEADER_BYTES;
+            iec->blocks += blocks;
+            iec61937_append(iec, iec->header, AC3_HEADER_BYTES);
+        }
+
+        size_t count = iec->frame_bytes - iec->frame_fill;
+        if (count > bytes - done) {
+            count = bytes - done;
+        }
+        iec61937_append(iec, &data[done], count);
+        iec->frame_fill += count;
+        done += count;
+        if (iec->frame_fill < iec->frame_bytes) {
+            continue;
+        }
+
+        /* Frame complete, look for the next header */
+        iec->header_fill = 0;
+        iec->frame_bytes = 0;
+        iec->frame_fill = 0;
+        if (iec->codec == IEC61937_AC3) {
+            *burst = iec61937_finish_burst(iec);
+            return done;
+        }
+    }
+    return done;
+}
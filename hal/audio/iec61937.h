@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * IEC 61937 framing of AC3 and E-AC3 for compressed passthrough over HDMI.
+ *
+ * Coded frames are cut out of an arbitrary byte stream and wrapped in data bursts: a 4 word
+ * preamble (sync Pa/Pb, burst info Pc, payload length Pd) followed by the frame as 16-bit words,
+ * zero padded to the repetition period of the format. Bursts are played as 16-bit stereo PCM,
+ * one word per sample, for the sink to decode:
+ * - AC3: one frame per burst, 1536 stereo frames at 48 kHz;
+ * - E-AC3: frames of the independent substream and their dependent substreams are gathered until
+ *   they hold 6 audio blocks, 6144 stereo frames at 192 kHz.
+ * Both carry 1536 samples of decoded audio per burst. Only 48 kHz streams are supported.
+ */
+
+#ifndef IEC61937_H
+#define IEC61937_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum iec61937_codec { IEC61937_AC3 = 0, IEC61937_EAC3 } iec61937_codec_t;
+
+/* Decoded frames per burst */
+#define IEC61937_AUDIO_FRAMES 1536
+/* Burst sizes, in bytes of 16-bit stereo PCM */
+#define IEC61937_AC3_BURST_BYTES (1536 * 4)
+#define IEC61937_EAC3_BURST_BYTES (6144 * 4)
+#define IEC61937_PREAMBLE_BYTES 8
+
+typedef struct iec61937 {
+    iec61937_codec_t codec;
+    uint32_t transport_rate;   /* PCM rate the bursts are played at */
+    size_t burst_bytes;
+    uint8_t* burst;            /* burst being assembled, payload after the preamble */
+    size_t payload_bytes;
+    uint32_t blocks;           /* E-AC3 audio blocks in the payload */
+    uint8_t bsmod;             /* AC3 bit stream mode, for Pc */
+    uint8_t header[8];         /* start of the frame being cut out */
+    size_t header_fill;
+    size_t frame_bytes;        /* size of that frame, 0 until its header is parsed */
+    size_t frame_fill;
+    uint64_t bursts;
+    uint64_t sync_losses;
+} iec61937_t;
+
+iec61937_t* iec61937_init(iec61937_codec_t codec);
+void iec61937_release(iec61937_t* iec);
+/* Drop partial frames and bursts, e.g. on standby or flush. */
+void iec61937_reset(iec61937_t* iec);
+
+/* Consume coded bytes from 'data'. Stops as soon as a burst is complete and points 'burst' at
+ * it, burst_bytes long and valid until the next call; 'burst' is NULL otherwise.
+ * Returns the number of bytes consumed. Bytes that do not parse as frames are skipped until the
+ * next sync word. */
+size_t iec61937_feed(iec61937_t* iec, const uint8_t* data, size_t bytes, const uint8_t** burst);
+
+#endif /* #ifndef IEC61937_H */
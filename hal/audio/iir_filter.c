@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_iir_filter"
+//#define LOG_NDEBUG 0
+
+#include <assert.h>
+#include <audio_utils/primitives.h>
+#include <log/log.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iir_filter.h"
+#include "rt_support.h"
+
+#ifdef __ARM_NEON
+#include "arm_neon.h"
+#endif /* #ifdef __ARM_NEON */
+
+enum { IIR_B0 = 0, IIR_B1, IIR_B2, IIR_A1, IIR_A2 };
+enum { IIR_X1 = 0, IIR_X2, IIR_Y1, IIR_Y2, IIR_STATE_SIZE };
+
+bool iir_biquad_is_stable(const int32_t* coeffs) {
+    /* Stability triangle: |a2| < 1 and |a1| < 1 + a2 */
+    int64_t one = 1LL << IIR_COEFF_FRAC_BITS;
+    int64_t a1 = coeffs[IIR_A1];
+    int64_t a2 = coeffs[IIR_A2];
+    return (a2 < one) && (a2 > -one) && (a1 < one + a2) && (-a1 < one + a2);
+}
+
+iir_filter_t* iir_init(uint32_t channels, fir_filter_mode_t mode,
+                       fir_sample_format_t sample_format, uint32_t num_sections,
+                       uint32_t input_length, const int32_t* coeffs) {
+    if ((channels == 0) || (num_sections == 0) || (num_sections > IIR_MAX_SECTIONS) ||
+        (coeffs == NULL)) {
+        ALOGE("%s: Invalid channel count, section count or coefficient array.", __func__);
+        return NULL;
+    }
+
+    iir_filter_t* iir = (iir_filter_t*)rt_heap_calloc(1, sizeof(iir_filter_t));
+    if (iir == NULL) {
+        ALOGE("%s: Unable to allocate memory for iir_filter.", __func__);
+        return NULL;
+    }
+
+    iir->mode = (mode == FIR_PER_CHANNEL_FILTER) ? FIR_PER_CHANNEL_FILTER : FIR_SINGLE_FILTER;
+    iir->sample_format = sample_format;
+    iir->channels = channels;
+    iir->num_sections = num_sections;
+    iir->stride = (channels + IIR_LANES - 1) / IIR_LANES * IIR_LANES;
+    iir->input_length = input_length;
+
+    iir->coeffs = (int32_t*)rt_heap_calloc(num_sections * IIR_BIQUAD_COEFFS * iir->stride,
+                                           sizeof(int32_t));
+    iir->state = (int32_t*)rt_heap_calloc(num_sections * IIR_STATE_SIZE * iir->stride,
+                                          sizeof(int32_t));
+    iir->error = (int64_t*)rt_heap_calloc(num_sections * iir->stride, sizeof(int64_t));
+    iir->frame = (int32_t*)rt_heap_calloc(iir->stride, sizeof(int32_t));
+    if (sample_format == FIR_SAMPLES_Q31) {
+        iir->input_q31 =
+                (int32_t*)rt_heap_calloc((size_t)input_length * channels, sizeof(int32_t));
+    }
+    if ((iir->coeffs == NULL) || (iir->state == NULL) || (iir->error == NULL) ||
+        (iir->frame == NULL) || ((sample_format == FIR_SAMPLES_Q31) && (iir->input_q31 == NULL))) {
+        ALOGE("%s: Unable to allocate memory for IIR coeffs or state", __func__);
+        goto error;
+    }
+
+    for (uint32_t ch = 0; ch < channels; ch++) {
+        const int32_t* set = (iir->mode == FIR_PER_CHANNEL_FILTER)
+                                     ? &coeffs[ch * num_sections * IIR_BIQUAD_COEFFS]
+                                     : coeffs;
+        for (uint32_t sec = 0; sec < num_sections; sec++) {
+            if (!iir_biquad_is_stable(&set[sec * IIR_BIQUAD_COEFFS])) {
+                ALOGE("%s: Section %u of channel %u is unstable", __func__, sec, ch);
+                goto error;
+            }
+            for (uint32_t i = 0; i < IIR_BIQUAD_COEFFS; i++) {
+                iir->coeffs[(sec * IIR_BIQUAD_COEFFS + i) * iir->stride + ch] =
+                        set[sec * IIR_BIQUAD_COEFFS + i];
+            }
+        }
+    }
+
+#ifdef __ARM_NEON
+    ALOGI("%s: Using ARM Neon", __func__);
+#endif /* #ifdef __ARM_NEON */
+
+    return iir;
+
+error:
+    iir_release(iir);
+    return NULL;
+}
+
+void iir_release(iir_filter_t* iir) {
+    if (iir == NULL) {
+        return;
+    }
+    rt_heap_free(iir->coeffs);
+    rt_heap_free(iir->state);
+    rt_heap_free(iir->error);
+    rt_heap_free(iir->frame);
+    rt_heap_free(iir->input_q31);
+    rt_heap_free(iir);
+}
+
+void iir_reset(iir_filter_t* iir) {
+    if (iir == NULL) {
+        return;
+    }
+    memset(iir->state, 0, iir->num_sections * IIR_STATE_SIZE * iir->stride * sizeof(int32_t));
+    memset(iir->error, 0, iir->num_sections * iir->stride * sizeof(int64_t));
+}
+
+/* Run the cascade over the Q31 frame in iir->frame, in place. */
+static void iir_process_frame(iir_filter_t* iir) {
+    const uint32_t stride = iir->stride;
+    int32_t* x = iir->frame;
+    for (uint32_t sec = 0; sec < iir->num_sections; sec++) {
+        const int32_t* c = &iir->coeffs[sec * IIR_BIQUAD_COEFFS * stride];
+        int32_t* st = &iir->state[sec * IIR_STATE_SIZE * stride];
+        int64_t* err = &iir->error[sec * stride];
+        for (uint32_t ch = 0; ch < stride; ch += IIR_LANES) {
+#ifdef __ARM_NEON
+            int32x2_t in = vld1_s32(&x[ch]);
+            int32x2_t x1 = vld1_s32(&st[IIR_X1 * stride + ch]);
+            int32x2_t x2 = vld1_s32(&st[IIR_X2 * stride + ch]);
+            int32x2_t y1 = vld1_s32(&st[IIR_Y1 * stride + ch]);
+            int32x2_t y2 = vld1_s32(&st[IIR_Y2 * stride + ch]);
+            int64x2_t acc = vld1q_s64(&err[ch]);
+            acc = vmlal_s32(acc, vld1_s32(&c[IIR_B0 * stride + ch]), in);
+            acc = vmlal_s32(acc, vld1_s32(&c[IIR_B1 * stride + ch]), x1);
+            acc = vmlal_s32(acc, vld1_s32(&c[IIR_B2 * stride + ch]), x2);
+            acc = vmlsl_s32(acc, vld1_s32(&c[IIR_A1 * stride + ch]), y1);
+            acc = vmlsl_s32(acc, vld1_s32(&c[IIR_A2 * stride + ch]), y2);
+            int64x2_t q = vshrq_n_s64(acc, IIR_COEFF_FRAC_BITS);
+            vst1q_s64(&err[ch], vsubq_s64(acc, vshlq_n_s64(q, IIR_COEFF_FRAC_BITS)));
+            int32x2_t y = vqmovn_s64(q);
+            vst1_s32(&st[IIR_X2 * stride + ch], x1);
+            vst1_s32(&st[IIR_X1 * stride + ch], in);
+            vst1_s32(&st[IIR_Y2 * stride + ch], y1);
+            vst1_s32(&st[IIR_Y1 * stride + ch], y);
+            vst1_s32(&x[ch], y);
+#else
+            for (uint32_t l = ch; l < ch + IIR_LANES; l++) {
+                int64_t acc = err[l];
+                acc += (int64_t)c[IIR_B0 * stride + l] * x[l];
+                acc += (int64_t)c[IIR_B1 * stride + l] * st[IIR_X1 * stride + l];
+                acc += (int64_t)c[IIR_B2 * stride + l] * st[IIR_X2 * stride + l];
+                acc -= (int64_t)c[IIR_A1 * stride + l] * st[IIR_Y1 * stride + l];
+                acc -= (int64_t)c[IIR_A2 * stride + l] * st[IIR_Y2 * stride + l];
+                int64_t q = acc >> IIR_COEFF_FRAC_BITS;
+                err[l] = acc - (q << IIR_COEFF_FRAC_BITS);
+                int32_t y = clamp32(q);
+                st[IIR_X2 * stride + l] = st[IIR_X1 * stride + l];
+                st[IIR_X1 * stride + l] = x[l];
+                st[IIR_Y2 * stride + l] = st[IIR_Y1 * stride + l];
+                st[IIR_Y1 * stride + l] = y;
+                x[l] = y;
+            }
+#endif /* #ifdef __ARM_NEON */
+        }
+    }
+}
+
+void iir_process_interleaved(iir_filter_t* iir, int16_t* input, int16_t* output, uint32_t samples,
+                             const gain_segment_t* gain) {
+    assert(iir != NULL);
+
+    const uint32_t channels = iir->channels;
+    bool apply_gain = (gain != NULL) && !gain_segment_is_unity(gain);
+    for (uint32_t s = 0; s < samples; s++) {
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            iir->frame[ch] = (int32_t)input[s * channels + ch] << 16;
+        }
+        iir_process_frame(iir);
+        int64_t g = apply_gain ? gain_segment_at(gain, s) : GAIN_UNITY;
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            int64_t y = iir->frame[ch];
+            if (apply_gain) {
+                y = (y * g) >> 30;
+            }
+            output[s * channels + ch] = clamp16((int32_t)((y + (1 << 15)) >> 16));
+        }
+    }
+}
+
+int32_t* iir_get_input_q31(iir_filter_t* iir) {
+    assert((iir != NULL) && (iir->input_q31 != NULL));
+    return iir->input_q31;
+}
+
+void iir_process_interleaved_q31(iir_filter_t* iir, int32_t* output, uint32_t samples,
+                                 const gain_segment_t* gain) {
+    assert((iir != NULL) && (iir->input_q31 != NULL) && (samples <= iir->input_length));
+
+    const uint32_t channels = iir->channels;
+    bool apply_gain = (gain != NULL) && !gain_segment_is_unity(gain);
+    for (uint32_t s = 0; s < samples; s++) {
+        memcpy(iir->frame, &iir->input_q31[s * channels], channels * sizeof(int32_t));
+        iir_process_frame(iir);
+        int64_t g = apply_gain ? gain_segment_at(gain, s) : GAIN_UNITY;
+        for (uint32_t ch = 0; ch < channels; ch++) {
+            int64_t y = iir->frame[ch];
+            output[s * channels + ch] = apply_gain ? clamp32((y * g) >> 30) : (int32_t)y;
+        }
+    }
+}
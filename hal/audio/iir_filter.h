@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IIR_FILTER_H
+#define IIR_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fir_filter.h"
+#include "gain_ramp.h"
+
+/* Channels processed together by one SIMD block (two 64-bit accumulators). */
+#define IIR_LANES 2
+
+/* Biquad coefficients are b0 b1 b2 a1 a2 (a0 normalized to 1) in Q28, so must lie in (-8, 8). */
+#define IIR_BIQUAD_COEFFS 5
+#define IIR_COEFF_FRAC_BITS 28
+#define IIR_MAX_SECTIONS 16
+
+/* Cascade of direct form I biquads on Q31 samples with 64-bit accumulation. Direct form I only
+ * stores past inputs and outputs, so quantized coefficients cannot push internal state out of
+ * range; the rounding error of each section is fed back into its next sample, which keeps low
+ * frequency sections free of limit cycles.
+ * Coefficients and state are stored section-major with 'stride' (channels rounded up to
+ * IIR_LANES) entries, so the kernel vectorizes across the channels of a frame. */
+typedef struct iir_filter {
+    fir_filter_mode_t mode;
+    fir_sample_format_t sample_format;
+    uint32_t channels;
+    uint32_t num_sections;
+    uint32_t stride;
+    uint32_t input_length;
+    int32_t* coeffs;    /* [section][IIR_BIQUAD_COEFFS][stride] */
+    int32_t* state;     /* [section][x1 x2 y1 y2][stride] */
+    int64_t* error;     /* [section][stride] */
+    int32_t* frame;     /* [stride] samples of the frame being processed */
+    int32_t* input_q31; /* FIR_SAMPLES_Q31 input, 'input_length' frames */
+} iir_filter_t;
+
+/* Returns true if the quantized Q28 section 'coeffs' has both poles inside the unit circle. */
+bool iir_biquad_is_stable(const int32_t* coeffs);
+
+/* 'coeffs' holds 'num_sections' x IIR_BIQUAD_COEFFS values, or 'channels' consecutive sets of
+ * them with FIR_PER_CHANNEL_FILTER. */
+iir_filter_t* iir_init(uint32_t channels, fir_filter_mode_t mode,
+                       fir_sample_format_t sample_format, uint32_t num_sections,
+                       uint32_t input_length, const int32_t* coeffs);
+void iir_release(iir_filter_t* iir);
+void iir_reset(iir_filter_t* iir);
+/* 'gain', if not NULL, is applied in the output stage. */
+void iir_process_interleaved(iir_filter_t* iir, int16_t* input, int16_t* output, uint32_t samples,
+                             const gain_segment_t* gain);
+
+/* Same split as the FIR: write 'samples' frames at iir_get_input_q31(), then process. */
+int32_t* iir_get_input_q31(iir_filter_t* iir);
+void iir_process_interleaved_q31(iir_filter_t* iir, int32_t* output, uint32_t samples,
+                                 const gain_segment_t* gain);
+
+#endif /* #ifndef IIR_FILTER_H */
@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_mic_preproc"
+//#define LOG_NDEBUG 0
+
+#include <audio_utils/primitives.h>
+#include <log/log.h>
+#include <math.h>
+#include <string.h>
+
+#include "mic_preproc.h"
+#include "rt_support.h"
+
+#ifdef __ARM_NEON
+#include "arm_neon.h"
+#endif /* #ifdef __ARM_NEON */
+
+enum { PP_B0 = 0, PP_B1, PP_B2, PP_A1, PP_A2 };
+enum { PP_DC_X1 = 0, PP_DC_Y1, PP_X1, PP_X2, PP_Y1, PP_Y2, PP_STATE_SIZE };
+enum { PP_DC_ERR = 0, PP_HP_ERR, PP_ERROR_SIZE };
+
+/* RBJ cookbook high-pass with Q = 1/sqrt(2), normalized to a0 = 1 and quantized to Q28 */
+static void mic_preproc_design_highpass(uint32_t rate, uint32_t highpass_hz, int32_t* coeffs) {
+    const double one = (double)(1 << IIR_COEFF_FRAC_BITS);
+    double w0 = 2.0 * M_PI * highpass_hz / rate;
+    double cos_w0 = cos(w0);
+    double alpha = sin(w0) / (2.0 * M_SQRT1_2);
+    double a0 = 1.0 + alpha;
+    coeffs[PP_B0] = (int32_t)lrint((1.0 + cos_w0) / 2.0 / a0 * one);
+    coeffs[PP_B1] = (int32_t)lrint(-(1.0 + cos_w0) / a0 * one);
+    coeffs[PP_B2] = coeffs[PP_B0];
+    coeffs[PP_A1] = (int32_t)lrint(-2.0 * cos_w0 / a0 * one);
+    coeffs[PP_A2] = (int32_t)lrint((1.0 - alpha) / a0 * one);
+}
+
+mic_preproc_t* mic_preproc_init(uint32_t channels, uint32_t rate, uint32_t highpass_hz) {
+    if ((channels == 0) || (rate == 0) || (highpass_hz >= rate / 2) ||
+        (MIC_PREPROC_DC_CUTOFF_HZ >= rate / 2)) {
+        ALOGE("%s: Invalid channel count, rate or high-pass frequency.", __func__);
+        return NULL;
+    }
+
+    mic_preproc_t* pp = (mic_preproc_t*)rt_heap_calloc(1, sizeof(mic_preproc_t));
+    if (pp == NULL) {
+        ALOGE("%s: Unable to allocate memory for mic_preproc.", __func__);
+        return NULL;
+    }
+    pp->channels = channels;
+    pp->rate = rate;
+    pp->highpass_hz = highpass_hz;
+    /* One pole at 1 - 2 pi fc / fs, one zero at DC */
+    pp->dc_pole = (int32_t)lrint((1.0 - 2.0 * M_PI * MIC_PREPROC_DC_CUTOFF_HZ / rate) *
+                                 (double)(1 << MIC_PREPROC_DC_FRAC_BITS));
+    if (highpass_hz > 0) {
+        mic_preproc_design_highpass(rate, highpass_hz, pp->coeffs);
+        if (!iir_biquad_is_stable(pp->coeffs)) {
+            ALOGE("%s: High-pass at %u Hz is unstable once quantized", __func__, highpass_hz);
+            goto error;
+        }
+    }
+
+    pp->state = (int32_t*)rt_heap_calloc(PP_STATE_SIZE * channels, sizeof(int32_t));
+    pp->error = (int64_t*)rt_heap_calloc(PP_ERROR_SIZE * channels, sizeof(int64_t));
+    if ((pp->state == NULL) || (pp->error == NULL)) {
+        ALOGE("%s: Unable to allocate memory for mic_preproc state", __func__);
+        goto error;
+    }
+
+#ifdef __ARM_NEON
+    ALOGI("%s: Using ARM Neon", __func__);
+#endif /* #ifdef __ARM_NEON */
+
+    return pp;
+
+error:
+    mic_preproc_release(pp);
+    return NULL;
+}
+
+void mic_preproc_release(mic_preproc_t* pp) {
+    if (pp == NULL) {
+        return;
+    }
+    rt_heap_free(pp->state);
+    rt_heap_free(pp->error);
+    rt_heap_free(pp);
+}
+
+void mic_preproc_reset(mic_preproc_t* pp) {
+    if (pp == NULL) {
+        return;
+    }
+    memset(pp->state, 0, PP_STATE_SIZE * pp->channels * sizeof(int32_t));
+    memset(pp->error, 0, PP_ERROR_SIZE * pp->channels * sizeof(int64_t));
+}
+
+#ifdef __ARM_NEON
+/* Coefficients and the state of two mics, held in registers over a period */
+typedef struct {
+    int32x2_t pole, b0, b1, b2, a1, a2;
+} mic_preproc_coeffs_neon_t;
+
+typedef struct {
+    int32x2_t dc_x1, dc_y1, x1, x2, y1, y2;
+    int64x2_t dc_err, hp_err;
+} mic_preproc_pair_t;
+
+static inline void mic_preproc_load_pair(const mic_preproc_t* pp, uint32_t ch,
+                                         mic_preproc_pair_t* s) {
+    const uint32_t channels = pp->channels;
+    s->dc_x1 = vld1_s32(&pp->state[PP_DC_X1 * channels + ch]);
+    s->dc_y1 = vld1_s32(&pp->state[PP_DC_Y1 * channels + ch]);
+    s->x1 = vld1_s32(&pp->state[PP_X1 * channels + ch]);
+    s->x2 = vld1_s32(&pp->state[PP_X2 * channels + ch]);
+    s->y1 = vld1_s32(&pp->state[PP_Y1 * channels + ch]);
+    s->y2 = vld1_s32(&pp->state[PP_Y2 * channels + ch]);
+    s->dc_err = vld1q_s64(&pp->error[PP_DC_ERR * channels + ch]);
+    s->hp_err = vld1q_s64(&pp->error[PP_HP_ERR * channels + ch]);
+}
+
+static inline void mic_preproc_store_pair(mic_preproc_t* pp, uint32_t ch,
+                                          const mic_preproc_pair_t* s) {
+    const uint32_t channels = pp->channels;
+    vst1_s32(&pp->state[PP_DC_X1 * channels + ch], s->dc_x1);
+    vst1_s32(&pp->state[PP_DC_Y1 * channels + ch], s->dc_y1);
+    vst1_s32(&pp->state[PP_X1 * channels + ch], s->x1);
+    vst1_s32(&pp->state[PP_X2 * channels + ch], s->x2);
+    vst1_s32(&pp->state[PP_Y1 * channels + ch], s->y1);
+    vst1_s32(&pp->state[PP_Y2 * channels + ch], s->y2);
+    vst1q_s64(&pp->error[PP_DC_ERR * channels + ch], s->dc_err);
+    vst1q_s64(&pp->error[PP_HP_ERR * channels + ch], s->hp_err);
+}
+
+/* One sample of two mics through both stages */
+static inline int32x2_t mic_preproc_step_pair(const mic_preproc_coeffs_neon_t* k,
+                                              mic_preproc_pair_t* s, int32x2_t x,
+                                              bool highpass) {
+    /* DC blocker: y = x - x1 + pole * y1 */
+    int64x2_t acc = vaddq_s64(s->dc_err,
+                              vshlq_n_s64(vsubl_s32(x, s->dc_x1), MIC_PREPROC_DC_FRAC_BITS));
+    acc = vmlal_s32(acc, k->pole, s->dc_y1);
+    int64x2_t q = vshrq_n_s64(acc, MIC_PREPROC_DC_FRAC_BITS);
+    s->dc_err = vsubq_s64(acc, vshlq_n_s64(q, MIC_PREPROC_DC_FRAC_BITS));
+    s->dc_x1 = x;
+    s->dc_y1 = vqmovn_s64(q);
+    if (!highpass) {
+        return s->dc_y1;
+    }
+    acc = vmlal_s32(s->hp_err, k->b0, s->dc_y1);
+    acc = vmlal_s32(acc, k->b1, s->x1);
+    acc = vmlal_s32(acc, k->b2, s->x2);
+    acc = vmlsl_s32(acc, k->a1, s->y1);
+    acc = vmlsl_s32(acc, k->a2, s->y2);
+    q = vshrq_n_s64(acc, IIR_COEFF_FRAC_BITS);
+    s->hp_err = vsubq_s64(acc, vshlq_n_s64(q, IIR_COEFF_FRAC_BITS));
+    s->x2 = s->x1;
+    s->x1 = s->dc_y1;
+    s->y2 = s->y1;
+    s->y1 = vqmovn_s64(q);
+    return s->y1;
+}
+#endif /* #ifdef __ARM_NEON */
+
+void mic_preproc_process(mic_preproc_t* pp, int32_t* buffer, uint32_t frames) {
+    const uint32_t channels = pp->channels;
+    const bool highpass = pp->highpass_hz > 0;
+    uint32_t ch = 0;
+
+#ifdef __ARM_NEON
+    const mic_preproc_coeffs_neon_t k = {
+            .pole = vdup_n_s32(pp->dc_pole),
+            .b0 = vdup_n_s32(pp->coeffs[PP_B0]),
+            .b1 = vdup_n_s32(pp->coeffs[PP_B1]),
+            .b2 = vdup_n_s32(pp->coeffs[PP_B2]),
+            .a1 = vdup_n_s32(pp->coeffs[PP_A1]),
+            .a2 = vdup_n_s32(pp->coeffs[PP_A2]),
+    };
+    /* Four mics at a time, a whole frame of the usual array per load */
+    for (; ch + 4 <= channels; ch += 4) {
+        mic_preproc_pair_t lo, hi;
+        mic_preproc_load_pair(pp, ch, &lo);
+        mic_preproc_load_pair(pp, ch + 2, &hi);
+        int32_t* p = &buffer[ch];
+        for (uint32_t s = 0; s < frames; s++, p += channels) {
+            int32x4_t x = vld1q_s32(p);
+            int32x2_t y_lo = mic_preproc_step_pair(&k, &lo, vget_low_s32(x), highpass);
+            int32x2_t y_hi = mic_preproc_step_pair(&k, &hi, vget_high_s32(x), highpass);
+            vst1q_s32(p, vcombine_s32(y_lo, y_hi));
+        }
+        mic_preproc_store_pair(pp, ch, &lo);
+        mic_preproc_store_pair(pp, ch + 2, &hi);
+    }
+    for (; ch + 2 <= channels; ch += 2) {
+        mic_preproc_pair_t pair;
+        mic_preproc_load_pair(pp, ch, &pair);
+        int32_t* p = &buffer[ch];
+        for (uint32_t s = 0; s < frames; s++, p += channels) {
+            vst1_s32(p, mic_preproc_step_pair(&k, &pair, vld1_s32(p), highpass));
+        }
+        mic_preproc_store_pair(pp, ch, &pair);
+    }
+#endif /* #ifdef __ARM_NEON */
+
+    for (; ch < channels; ch++) {
+        int32_t* st = &pp->state[ch];
+        int64_t* err = &pp->error[ch];
+        const int32_t* c = pp->coeffs;
+        int32_t* p = &buffer[ch];
+        for (uint32_t s = 0; s < frames; s++, p += channels) {
+            int32_t x = *p;
+            int64_t acc = err[PP_DC_ERR * channels] +
+                          (((int64_t)x - st[PP_DC_X1 * channels]) << MIC_PREPROC_DC_FRAC_BITS) +
+                          (int64_t)pp->dc_pole * st[PP_DC_Y1 * channels];
+            int64_t q = acc >> MIC_PREPROC_DC_FRAC_BITS;
+            err[PP_DC_ERR * channels] = acc - (q << MIC_PREPROC_DC_FRAC_BITS);
+            st[PP_DC_X1 * channels] = x;
+            int32_t y = clamp32(q);
+            st[PP_DC_Y1 * channels] = y;
+            if (highpass) {
+                acc = err[PP_HP_ERR * channels];
+                acc += (int64_t)c[PP_B0] * y;
+                acc += (int64_t)c[PP_B1] * st[PP_X1 * channels];
+                acc += (int64_t)c[PP_B2] * st[PP_X2 * channels];
+                acc -= (int64_t)c[PP_A1] * st[PP_Y1 * channels];
+                acc -= (int64_t)c[PP_A2] * st[PP_Y2 * channels];
+                q = acc >> IIR_COEFF_FRAC_BITS;
+                err[PP_HP_ERR * channels] = acc - (q << IIR_COEFF_FRAC_BITS);
+                st[PP_X2 * channels] = st[PP_X1 * channels];
+                st[PP_X1 * channels] = y;
+                st[PP_Y2 * channels] = st[PP_Y1 * channels];
+                y = clamp32(q);
+                st[PP_Y1 * channels] = y;
+            }
+            *p = y;
+        }
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Mic preprocessing: DC removal and a high-pass biquad on every captured mic, ahead of AEC.
+ *
+ * Raw mics carry a DC offset and low frequency rumble that AEC and recognisers would otherwise
+ * spend adaptation on. Both stages run in a single pass over the interleaved Q31 period, in
+ * place: the DC blocker output goes straight into the biquad without a round trip to memory.
+ * All mics share the coefficients, and the state of each pair of mics stays in registers for
+ * the whole period.
+ * Like iir_filter, both stages accumulate in 64 bits and feed their rounding error back into the
+ * next sample, so a low corner frequency leaves neither a residual offset nor limit cycles.
+ */
+
+#ifndef MIC_PREPROC_H
+#define MIC_PREPROC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "iir_filter.h"
+
+/* Corner of the DC blocker, well below anything the mics are expected to pick up */
+#define MIC_PREPROC_DC_CUTOFF_HZ 10
+/* The DC blocker pole is in Q30 */
+#define MIC_PREPROC_DC_FRAC_BITS 30
+
+typedef struct mic_preproc {
+    uint32_t channels;
+    uint32_t rate;
+    uint32_t highpass_hz;              /* 0 if the biquad is bypassed */
+    int32_t dc_pole;                   /* Q30 */
+    int32_t coeffs[IIR_BIQUAD_COEFFS]; /* Q28 b0 b1 b2 a1 a2, see iir_filter.h */
+    int32_t* state;                    /* [dc_x1 dc_y1 x1 x2 y1 y2][channels] */
+    int64_t* error;                    /* [dc biquad][channels] */
+} mic_preproc_t;
+
+/* Create the stage for 'channels' mics at 'rate', with a second order Butterworth high-pass at
+ * 'highpass_hz', or only the DC blocker if 0.
+ * Returns NULL if the corner frequency is not below Nyquist. */
+mic_preproc_t* mic_preproc_init(uint32_t channels, uint32_t rate, uint32_t highpass_hz);
+void mic_preproc_release(mic_preproc_t* pp);
+/* Forget the past, e.g. when capture restarts or a period was lost. */
+void mic_preproc_reset(mic_preproc_t* pp);
+
+/* Filter 'frames' interleaved Q31 frames of all mics in place. */
+void mic_preproc_process(mic_preproc_t* pp, int32_t* buffer, uint32_t frames);
+
+#endif /* #ifndef MIC_PREPROC_H */
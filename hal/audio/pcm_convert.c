@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_pcm_convert"
+//#define LOG_NDEBUG 0
+
+#include <audio_utils/primitives.h>
+#include <log/log.h>
+#include <string.h>
+
+#include "pcm_convert.h"
+
+#ifdef __ARM_NEON
+#include "arm_neon.h"
+#endif /* #ifdef __ARM_NEON */
+
+static void convert_to_i16_from_i32(int16_t* dst, const int32_t* src, size_t samples) {
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 8 <= samples; i += 8) {
+        int32x4_t in_lo = vld1q_s32(&src[i]);
+        int32x4_t in_hi = vld1q_s32(&src[i + 4]);
+        /* Rounding, saturating narrow */
+        vst1q_s16(&dst[i], vcombine_s16(vqrshrn_n_s32(in_lo, 16), vqrshrn_n_s32(in_hi, 16)));
+    }
+#endif /* #ifdef __ARM_NEON */
+    for (; i < samples; i++) {
+        dst[i] = clamp16((int32_t)(((int64_t)src[i] + (1 << 15)) >> 16));
+    }
+}
+
+static void convert_to_float_from_i32(float* dst, const int32_t* src, size_t samples) {
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 4 <= samples; i += 4) {
+        vst1q_f32(&dst[i], vcvtq_n_f32_s32(vld1q_s32(&src[i]), 31));
+    }
+#endif /* #ifdef __ARM_NEON */
+    for (; i < samples; i++) {
+        dst[i] = src[i] * (1.0f / (1U << 31));
+    }
+}
+
+static void convert_to_i32_from_i16(int32_t* dst, const int16_t* src, size_t samples) {
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 4 <= samples; i += 4) {
+        vst1q_s32(&dst[i], vshll_n_s16(vld1_s16(&src[i]), 16));
+    }
+#endif /* #ifdef __ARM_NEON */
+    for (; i < samples; i++) {
+        dst[i] = (int32_t)src[i] << 16;
+    }
+}
+
+static void convert_to_i32_from_float(int32_t* dst, const float* src, size_t samples) {
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 4 <= samples; i += 4) {
+        /* Float to fixed point conversion saturates */
+        vst1q_s32(&dst[i], vcvtq_n_s32_f32(vld1q_f32(&src[i]), 31));
+    }
+#endif /* #ifdef __ARM_NEON */
+    for (; i < samples; i++) {
+        dst[i] = clamp32_from_float(src[i]);
+    }
+}
+
+static void convert_to_i32_from_p24(int32_t* dst, const uint8_t* src, size_t samples) {
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 8 <= samples; i += 8) {
+        /* De-interleave the three bytes of 8 samples, then zip the low and high halves back
+         * together as 32-bit little endian words. */
+        uint8x8x3_t in = vld3_u8(&src[i * 3]);
+        uint16x8_t lo = vshll_n_u8(in.val[0], 8);
+        uint16x8_t hi = vorrq_u16(vmovl_u8(in.val[1]), vshll_n_u8(in.val[2], 8));
+        uint16x8x2_t out = vzipq_u16(lo, hi);
+        vst1q_s32(&dst[i], vreinterpretq_s32_u16(out.val[0]));
+        vst1q_s32(&dst[i + 4], vreinterpretq_s32_u16(out.val[1]));
+    }
+#endif /* #ifdef __ARM_NEON */
+    for (; i < samples; i++) {
+        const uint8_t* p = &src[i * 3];
+        dst[i] = (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24));
+    }
+}
+
+static void emit_i16_from_i32(int16_t* dst, int16_t* ref, const int32_t* src, size_t samples) {
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 8 <= samples; i += 8) {
+        int16x8_t out = vcombine_s16(vqrshrn_n_s32(vld1q_s32(&src[i]), 16),
+                                     vqrshrn_n_s32(vld1q_s32(&src[i + 4]), 16));
+        vst1q_s16(&dst[i], out);
+        if ((ref != NULL) && (ref != dst)) {
+            vst1q_s16(&ref[i], out);
+        }
+    }
+#endif /* #ifdef __ARM_NEON */
+    for (; i < samples; i++) {
+        dst[i] = clamp16((int32_t)(((int64_t)src[i] + (1 << 15)) >> 16));
+        if (ref != NULL) {
+            ref[i] = dst[i];
+        }
+    }
+}
+
+static void emit_i32_from_i32(int32_t* dst, int16_t* ref, const int32_t* src, size_t samples) {
+    if (ref == NULL) {
+        if (dst != src) {
+            memcpy(dst, src, samples * sizeof(int32_t));
+        }
+        return;
+    }
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 8 <= samples; i += 8) {
+        int32x4_t in_lo = vld1q_s32(&src[i]);
+        int32x4_t in_hi = vld1q_s32(&src[i + 4]);
+        vst1q_s32(&dst[i], in_lo);
+        vst1q_s32(&dst[i + 4], in_hi);
+        vst1q_s16(&ref[i], vcombine_s16(vqrshrn_n_s32(in_lo, 16), vqrshrn_n_s32(in_hi, 16)));
+    }
+#endif /* #ifdef __ARM_NEON */
+    for (; i < samples; i++) {
+        int32_t sample = src[i];
+        dst[i] = sample;
+        ref[i] = clamp16((int32_t)(((int64_t)sample + (1 << 15)) >> 16));
+    }
+}
+
+bool pcm_convert_from_i32_supported(audio_format_t format) {
+    return (format == AUDIO_FORMAT_PCM_16_BIT) || (format == AUDIO_FORMAT_PCM_32_BIT) ||
+           (format == AUDIO_FORMAT_PCM_FLOAT);
+}
+
+void pcm_convert_from_i32(void* dst, audio_format_t format, const int32_t* src, size_t samples,
+                          bool mute) {
+    if (mute) {
+        memset(dst, 0, samples * audio_bytes_per_sample(format));
+        return;
+    }
+    switch (format) {
+        case AUDIO_FORMAT_PCM_16_BIT:
+            convert_to_i16_from_i32((int16_t*)dst, src, samples);
+            break;
+        case AUDIO_FORMAT_PCM_FLOAT:
+            convert_to_float_from_i32((float*)dst, src, samples);
+            break;
+        case AUDIO_FORMAT_PCM_32_BIT:
+            memcpy(dst, src, samples * sizeof(int32_t));
+            break;
+        default:
+            ALOGE("%s: Unsupported format %#x", __func__, format);
+            memset(dst, 0, samples * audio_bytes_per_sample(format));
+            break;
+    }
+}
+
+bool pcm_convert_to_i32_supported(audio_format_t format) {
+    return (format == AUDIO_FORMAT_PCM_16_BIT) || (format == AUDIO_FORMAT_PCM_8_24_BIT) ||
+           (format == AUDIO_FORMAT_PCM_32_BIT) || (format == AUDIO_FORMAT_PCM_24_BIT_PACKED) ||
+           (format == AUDIO_FORMAT_PCM_FLOAT);
+}
+
+void pcm_convert_to_i32(int32_t* dst, const void* src, audio_format_t format, size_t samples) {
+    switch (format) {
+        case AUDIO_FORMAT_PCM_16_BIT:
+            convert_to_i32_from_i16(dst, (const int16_t*)src, samples);
+            break;
+        case AUDIO_FORMAT_PCM_8_24_BIT:
+            memcpy_to_i32_from_q8_23(dst, (const int32_t*)src, samples);
+            break;
+        case AUDIO_FORMAT_PCM_32_BIT:
+            memcpy(dst, src, samples * sizeof(int32_t));
+            break;
+        case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+            convert_to_i32_from_p24(dst, (const uint8_t*)src, samples);
+            break;
+        case AUDIO_FORMAT_PCM_FLOAT:
+            convert_to_i32_from_float(dst, (const float*)src, samples);
+            break;
+        default:
+            ALOGE("%s: Unsupported format %#x", __func__, format);
+            memset(dst, 0, samples * sizeof(int32_t));
+            break;
+    }
+}
+
+void pcm_convert_emit_from_i32(void* dst, enum pcm_format format, int16_t* ref,
+                               const int32_t* src, size_t samples) {
+    switch (format) {
+        case PCM_FORMAT_S16_LE:
+            emit_i16_from_i32((int16_t*)dst, ref, src, samples);
+            break;
+        case PCM_FORMAT_S32_LE:
+            emit_i32_from_i32((int32_t*)dst, ref, src, samples);
+            break;
+        default:
+            ALOGE("%s: Unsupported format %d", __func__, format);
+            memset(dst, 0, samples * (pcm_format_to_bits(format) >> 3));
+            if (ref != NULL) {
+                memset(ref, 0, samples * sizeof(int16_t));
+            }
+            break;
+    }
+}
+
+void pcm_accumulate_i16(int16_t* dst, const int16_t* src, size_t samples) {
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 8 <= samples; i += 8) {
+        vst1q_s16(&dst[i], vqaddq_s16(vld1q_s16(&dst[i]), vld1q_s16(&src[i])));
+    }
+#endif /* #ifdef __ARM_NEON */
+    for (; i < samples; i++) {
+        dst[i] = clamp16((int32_t)dst[i] + src[i]);
+    }
+}
+
+void pcm_accumulate_i32(int32_t* dst, const int32_t* src, size_t samples) {
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 4 <= samples; i += 4) {
+        vst1q_s32(&dst[i], vqaddq_s32(vld1q_s32(&dst[i]), vld1q_s32(&src[i])));
+    }
+#endif /* #ifdef __ARM_NEON */
+    for (; i < samples; i++) {
+        dst[i] = clamp32((int64_t)dst[i] + src[i]);
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PCM_CONVERT_H
+#define PCM_CONVERT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <system/audio.h>
+#include <tinyalsa/asoundlib.h>
+
+/* Returns true if pcm_convert_from_i32() can produce 'format'. */
+bool pcm_convert_from_i32_supported(audio_format_t format);
+
+/* Convert 'samples' Q31 samples to 'format' (16-bit, 32-bit or float PCM).
+ * With 'mute' set the output is zeroed instead, without reading 'src'. */
+void pcm_convert_from_i32(void* dst, audio_format_t format, const int32_t* src, size_t samples,
+                          bool mute);
+
+/* Returns true if pcm_convert_to_i32() accepts 'format'. */
+bool pcm_convert_to_i32_supported(audio_format_t format);
+
+/* Convert 'samples' samples of 'format' (16-bit, 8.24, 32-bit, packed 24-bit or float PCM) to
+ * Q31. Float input is clamped to [-1.0, 1.0). */
+void pcm_convert_to_i32(int32_t* dst, const void* src, audio_format_t format, size_t samples);
+
+/* Playback output stage: convert 'samples' Q31 samples to 'format' (PCM_FORMAT_S16_LE or
+ * PCM_FORMAT_S32_LE) in 'dst' and, in the same pass, to 16-bit in 'ref' for the echo reference.
+ * 'ref' may be NULL, or equal to 'dst' when 'format' is PCM_FORMAT_S16_LE. */
+void pcm_convert_emit_from_i32(void* dst, enum pcm_format format, int16_t* ref,
+                               const int32_t* src, size_t samples);
+
+/* Saturating 'dst' += 'src' over 'samples' samples. */
+void pcm_accumulate_i16(int16_t* dst, const int16_t* src, size_t samples);
+void pcm_accumulate_i32(int32_t* dst, const int32_t* src, size_t samples);
+
+#endif /* #ifndef PCM_CONVERT_H */
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_proc_budget"
+//#define LOG_NDEBUG 0
+
+#include <audio_utils/clock.h>
+#include <log/log.h>
+#include <time.h>
+
+#include "proc_budget.h"
+
+void proc_budget_init(proc_budget_t* budget, const char* name, uint32_t rate,
+                      uint32_t budget_percent) {
+    budget->name = name;
+    budget->rate = rate;
+    budget->high_permille = budget_percent * 10;
+    /* Hysteresis: only restore once there is twice the headroom that triggered the drop */
+    budget->low_permille = budget->high_permille / 2;
+    budget->overruns = 0;
+    budget->degradations = 0;
+    proc_budget_reset(budget);
+}
+
+void proc_budget_reset(proc_budget_t* budget) {
+    budget->quality = PROC_QUALITY_FULL;
+    budget->calm_nsec = 0;
+    budget->load_permille = 0;
+}
+
+uint64_t proc_budget_now_nsec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return audio_utils_ns_from_timespec(&now);
+}
+
+proc_quality_t proc_budget_update(proc_budget_t* budget, uint64_t elapsed_nsec, size_t frames) {
+    if ((frames == 0) || (budget->rate == 0)) {
+        return budget->quality;
+    }
+    uint64_t duration_nsec = (uint64_t)frames * NANOS_PER_SECOND / budget->rate;
+    budget->load_permille = (uint32_t)(elapsed_nsec * 1000 / duration_nsec);
+
+    if (budget->load_permille > budget->high_permille) {
+        budget->overruns++;
+        budget->calm_nsec = 0;
+        if (budget->quality < PROC_QUALITY_MINIMAL) {
+            budget->quality++;
+            budget->degradations++;
+            ALOGW("%s: used %u%% of its deadline, dropping to quality level %d", budget->name,
+                  budget->load_permille / 10, budget->quality);
+        }
+    } else if (budget->load_permille > budget->low_permille) {
+        budget->calm_nsec = 0;
+    } else if (budget->quality > PROC_QUALITY_FULL) {
+        budget->calm_nsec += duration_nsec;
+        if (budget->calm_nsec >= (uint64_t)PROC_BUDGET_RESTORE_MS * NANOS_PER_MILLISECOND) {
+            budget->quality--;
+            budget->calm_nsec = 0;
+            ALOGI("%s: load back to %u%%, restoring quality level %d", budget->name,
+                  budget->load_permille / 10, budget->quality);
+        }
+    }
+    return budget->quality;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Processing budget: compares the time a DSP stage takes with the duration of the audio it
+ * processed, and picks the quality the stage should run at next so an overloaded system degrades
+ * the processing instead of missing its deadline. Quality drops one level as soon as a chunk
+ * overruns the budget and comes back one level at a time once the load has stayed low for
+ * PROC_BUDGET_RESTORE_MS of audio.
+ */
+
+#ifndef PROC_BUDGET_H
+#define PROC_BUDGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Audio time the load must stay under the low watermark before quality goes up a level. */
+#define PROC_BUDGET_RESTORE_MS 2000
+
+/* What each level means is up to the stage; higher levels are cheaper. */
+typedef enum proc_quality {
+    PROC_QUALITY_FULL = 0,
+    PROC_QUALITY_REDUCED,
+    PROC_QUALITY_MINIMAL,
+} proc_quality_t;
+
+typedef struct proc_budget {
+    const char* name;         /* for logs */
+    uint32_t rate;
+    uint32_t high_permille;   /* a chunk above this share of its duration is an overrun */
+    uint32_t low_permille;    /* load under which quality may be restored */
+    proc_quality_t quality;
+    uint64_t calm_nsec;       /* audio time below low_permille since the last overrun */
+    uint32_t load_permille;   /* load of the last chunk */
+    uint64_t overruns;
+    uint64_t degradations;
+} proc_budget_t;
+
+/* A stage processing audio at 'rate' may use up to 'budget_percent' of the audio duration. */
+void proc_budget_init(proc_budget_t* budget, const char* name, uint32_t rate,
+                      uint32_t budget_percent);
+
+/* Go back to full quality, e.g. when the stream restarts. */
+void proc_budget_reset(proc_budget_t* budget);
+
+/* CLOCK_MONOTONIC time for timing a stage. */
+uint64_t proc_budget_now_nsec(void);
+
+/* Account 'elapsed_nsec' spent processing 'frames' frames. Returns the quality for the next
+ * chunk, also kept in budget->quality. */
+proc_quality_t proc_budget_update(proc_budget_t* budget, uint64_t elapsed_nsec, size_t frames);
+
+#endif /* #ifndef PROC_BUDGET_H */
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_rt_support"
+//#define LOG_NDEBUG 0
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* cpu_set_t */
+#endif
+
+#include <cutils/properties.h>
+#include <errno.h>
+#include <log/log.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "rt_support.h"
+
+/* Every block starts with a header padded to RT_HEAP_ALIGN; 'size' includes it. Blocks tile the
+ * heap in address order. */
+typedef struct rt_block {
+    size_t size;
+    bool free;
+} rt_block_t;
+
+#define RT_BLOCK_HEADER_SIZE \
+    ((sizeof(rt_block_t) + RT_HEAP_ALIGN - 1) / RT_HEAP_ALIGN * RT_HEAP_ALIGN)
+
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t* heap_base;
+static size_t heap_size;
+
+#if DEBUG_RT_ALLOC
+static __thread bool in_hot_path;
+#endif /* #if DEBUG_RT_ALLOC */
+
+static void rt_heap_init(void) {
+    void* base = mmap(NULL, RT_HEAP_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (base == MAP_FAILED) {
+        ALOGE("%s: Unable to map %d bytes: %s", __func__, RT_HEAP_SIZE, strerror(errno));
+        return;
+    }
+    /* Not fatal: the heap is prefaulted anyway, it may just be paged out under pressure */
+    if (mlock(base, RT_HEAP_SIZE) != 0) {
+        ALOGW("%s: Unable to lock heap: %s", __func__, strerror(errno));
+    }
+    heap_base = (uint8_t*)base;
+    heap_size = RT_HEAP_SIZE;
+    rt_block_t* block = (rt_block_t*)heap_base;
+    block->size = heap_size;
+    block->free = true;
+}
+
+static bool rt_heap_contains(const void* ptr) {
+    return (heap_base != NULL) && ((const uint8_t*)ptr >= heap_base) &&
+           ((const uint8_t*)ptr < heap_base + heap_size);
+}
+
+/* must be called with heap_lock held */
+static void* rt_heap_alloc_l(size_t bytes) {
+    size_t needed = RT_BLOCK_HEADER_SIZE + (bytes + RT_HEAP_ALIGN - 1) / RT_HEAP_ALIGN *
+                                                   RT_HEAP_ALIGN;
+    for (uint8_t* p = heap_base; p < heap_base + heap_size; p += ((rt_block_t*)p)->size) {
+        rt_block_t* block = (rt_block_t*)p;
+        if (!block->free || (block->size < needed)) {
+            continue;
+        }
+        if (block->size - needed >= 2 * RT_BLOCK_HEADER_SIZE) {
+            rt_block_t* rest = (rt_block_t*)(p + needed);
+            rest->size = block->size - needed;
+            rest->free = true;
+            block->size = needed;
+        }
+        block->free = false;
+        return p + RT_BLOCK_HEADER_SIZE;
+    }
+    return NULL;
+}
+
+/* must be called with heap_lock held */
+static void rt_heap_coalesce_l(void) {
+    rt_block_t* block = (rt_block_t*)heap_base;
+    while ((uint8_t*)block + block->size < heap_base + heap_size) {
+        rt_block_t* next = (rt_block_t*)((uint8_t*)block + block->size);
+        if (block->free && next->free) {
+            block->size += next->size;
+        } else {
+            block = next;
+        }
+    }
+}
+
+void* rt_heap_calloc(size_t count, size_t size) {
+#if DEBUG_RT_ALLOC
+    LOG_ALWAYS_FATAL_IF(in_hot_path, "%s: allocation on the audio hot path", __func__);
+#endif /* #if DEBUG_RT_ALLOC */
+    if ((size != 0) && (count > SIZE_MAX / size)) {
+        return NULL;
+    }
+    size_t bytes = count * size;
+
+    pthread_once(&heap_once, rt_heap_init);
+    void* ptr = NULL;
+    if (heap_base != NULL) {
+        pthread_mutex_lock(&heap_lock);
+        ptr = rt_heap_alloc_l(bytes);
+        pthread_mutex_unlock(&heap_lock);
+    }
+    if (ptr == NULL) {
+        ALOGW("%s: %zu bytes do not fit in the locked heap, using calloc()", __func__, bytes);
+        return calloc(1, bytes);
+    }
+    /* Recycled blocks may hold old data */
+    memset(ptr, 0, bytes);
+    return ptr;
+}
+
+void rt_heap_free(void* ptr) {
+#if DEBUG_RT_ALLOC
+    LOG_ALWAYS_FATAL_IF(in_hot_path, "%s: free on the audio hot path", __func__);
+#endif /* #if DEBUG_RT_ALLOC */
+    if (ptr == NULL) {
+        return;
+    }
+    if (!rt_heap_contains(ptr)) {
+        free(ptr);
+        return;
+    }
+    pthread_mutex_lock(&heap_lock);
+    rt_block_t* block = (rt_block_t*)((uint8_t*)ptr - RT_BLOCK_HEADER_SIZE);
+    block->free = true;
+    rt_heap_coalesce_l();
+    pthread_mutex_unlock(&heap_lock);
+}
+
+void rt_hot_path_enter(void) {
+#if DEBUG_RT_ALLOC
+    in_hot_path = true;
+#endif /* #if DEBUG_RT_ALLOC */
+}
+
+void rt_hot_path_leave(void) {
+#if DEBUG_RT_ALLOC
+    in_hot_path = false;
+#endif /* #if DEBUG_RT_ALLOC */
+}
+
+void rt_thread_configure(const char* name) {
+    int32_t priority = property_get_int32(RT_THREAD_PRIORITY_PROPERTY, 0);
+    if (priority > 0) {
+        struct sched_param param = {.sched_priority = priority};
+        int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret != 0) {
+            ALOGW("%s: %s: Unable to set SCHED_FIFO priority %d: %s", __func__, name, priority,
+                  strerror(ret));
+        }
+    }
+
+    char cpus[PROPERTY_VALUE_MAX];
+    if (property_get(RT_THREAD_CPUS_PROPERTY, cpus, "") > 0) {
+        unsigned long mask = strtoul(cpus, NULL, 0);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < (int)(sizeof(mask) * 8); cpu++) {
+            if (mask & (1UL << cpu)) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        if ((mask == 0) || (sched_setaffinity(0, sizeof(set), &set) != 0)) {
+            ALOGW("%s: %s: Unable to set CPU affinity %s", __func__, name, cpus);
+        }
+    }
+}
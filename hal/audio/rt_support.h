@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Real-time support for the audio hot path (out_write(), in_read() and the capture thread).
+ *
+ * Buffers the hot path touches come from one heap that is mmapped, prefaulted and mlocked the
+ * first time it is used, so no period takes a page fault on them, including the first one after
+ * standby. The heap is only allocated from when streams are opened or reconfigured; its mutex is
+ * never taken on the hot path. With DEBUG_RT_ALLOC set, e.g. by building with
+ * AUDIO_DEBUG_RT_ALLOC=1, an rt_heap allocation from a thread inside
+ * rt_hot_path_enter()/rt_hot_path_leave() aborts, to catch regressions. The bracket costs a
+ * thread-local store, so it may be taken once per period.
+ *
+ * HAL-owned audio threads may also be given SCHED_FIFO priority and a CPU affinity through
+ * system properties, see rt_thread_configure().
+ */
+
+#ifndef RT_SUPPORT_H
+#define RT_SUPPORT_H
+
+#include <stddef.h>
+
+#ifndef DEBUG_RT_ALLOC
+#define DEBUG_RT_ALLOC 0
+#endif
+
+/* Size of the locked heap. Allocations that do not fit fall back to calloc(). */
+#define RT_HEAP_SIZE (2 * 1024 * 1024)
+/* Alignment of every allocation, one cache line */
+#define RT_HEAP_ALIGN 64
+
+/* SCHED_FIFO priority for HAL-owned audio threads, 0 leaves them SCHED_OTHER */
+#define RT_THREAD_PRIORITY_PROPERTY "vendor.audio.hal_thread_priority"
+/* CPU affinity mask for HAL-owned audio threads, e.g. "0xc", empty for no affinity */
+#define RT_THREAD_CPUS_PROPERTY "vendor.audio.hal_thread_cpus"
+
+/* Zeroed memory from the locked heap. Returns NULL on failure. */
+void* rt_heap_calloc(size_t count, size_t size);
+/* Free memory from rt_heap_calloc(), wherever it came from. NULL is ignored. */
+void rt_heap_free(void* ptr);
+
+/* Bracket the hot path of the calling thread, see DEBUG_RT_ALLOC. */
+void rt_hot_path_enter(void);
+void rt_hot_path_leave(void);
+
+/* Apply RT_THREAD_PRIORITY_PROPERTY and RT_THREAD_CPUS_PROPERTY to the calling thread. */
+void rt_thread_configure(const char* name);
+
+#endif /* #ifndef RT_SUPPORT_H */
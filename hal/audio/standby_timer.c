@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_standby_timer"
+//#define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <audio_utils/clock.h>
+#include <log/log.h>
+
+#include "proc_budget.h"
+#include "standby_timer.h"
+
+struct standby_timer {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    /* armed list changed, or a callback returned */
+    pthread_t thread;
+    bool exit_thread;
+    struct standby_timer_entry* armed;          /* unsorted, there are only a few streams */
+    const struct standby_timer_entry* running;  /* entry whose callback is being called */
+};
+
+static void standby_timer_unlink_l(struct standby_timer* timer,
+                                   struct standby_timer_entry* entry) {
+    for (struct standby_timer_entry** p = &timer->armed; *p != NULL; p = &(*p)->next) {
+        if (*p == entry) {
+            *p = entry->next;
+            break;
+        }
+    }
+    entry->next = NULL;
+    entry->armed = false;
+}
+
+static void* standby_timer_thread(void* context) {
+    struct standby_timer* timer = (struct standby_timer*)context;
+
+    pthread_mutex_lock(&timer->lock);
+    while (!timer->exit_thread) {
+        uint64_t now_nsec = proc_budget_now_nsec();
+        struct standby_timer_entry* next = NULL;
+        for (struct standby_timer_entry* e = timer->armed; e != NULL; e = e->next) {
+            if ((next == NULL) || (e->deadline_nsec < next->deadline_nsec)) {
+                next = e;
+            }
+        }
+        if (next == NULL) {
+            pthread_cond_wait(&timer->cond, &timer->lock);
+            continue;
+        }
+        if (next->deadline_nsec > now_nsec) {
+            struct timespec deadline = {
+                    .tv_sec = next->deadline_nsec / NANOS_PER_SECOND,
+                    .tv_nsec = next->deadline_nsec % NANOS_PER_SECOND,
+            };
+            pthread_cond_timedwait(&timer->cond, &timer->lock, &deadline);
+            continue;
+        }
+
+        standby_timer_unlink_l(timer, next);
+        timer->running = next;
+        pthread_mutex_unlock(&timer->lock);
+        next->callback(next->context);
+        pthread_mutex_lock(&timer->lock);
+        timer->running = NULL;
+        pthread_cond_broadcast(&timer->cond);
+    }
+    pthread_mutex_unlock(&timer->lock);
+    return NULL;
+}
+
+struct standby_timer* standby_timer_init(void) {
+    struct standby_timer* timer = (struct standby_timer*)calloc(1, sizeof(struct standby_timer));
+    if (timer == NULL) {
+        ALOGE("%s: Unable to allocate memory for standby timer.", __func__);
+        return NULL;
+    }
+
+    /* Deadlines are CLOCK_MONOTONIC, like proc_budget_now_nsec() */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&timer->lock, NULL);
+
+    if (pthread_create(&timer->thread, NULL, standby_timer_thread, timer)) {
+        ALOGE("%s: Failed to create standby timer thread", __func__);
+        goto exit_1;
+    }
+    pthread_setname_np(timer->thread, "standby_timer");
+    return timer;
+
+exit_1:
+    pthread_mutex_destroy(&timer->lock);
+    pthread_cond_destroy(&timer->cond);
+    free(timer);
+    return NULL;
+}
+
+void standby_timer_release(struct standby_timer* timer) {
+    if (timer == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&timer->lock);
+    timer->exit_thread = true;
+    pthread_cond_broadcast(&timer->cond);
+    pthread_mutex_unlock(&timer->lock);
+    pthread_join(timer->thread, NULL);
+
+    pthread_mutex_destroy(&timer->lock);
+    pthread_cond_destroy(&timer->cond);
+    free(timer);
+}
+
+void standby_timer_entry_init(struct standby_timer_entry* entry,
+                              standby_timer_callback_t callback, void* context) {
+    entry->callback = callback;
+    entry->context = context;
+    entry->deadline_nsec = 0;
+    entry->armed = false;
+    entry->next = NULL;
+}
+
+void standby_timer_arm(struct standby_timer* timer, struct standby_timer_entry* entry,
+                       uint32_t delay_ms) {
+    pthread_mutex_lock(&timer->lock);
+    entry->deadline_nsec = proc_budget_now_nsec() + (uint64_t)delay_ms * NANOS_PER_MILLISECOND;
+    if (!entry->armed) {
+        entry->next = timer->armed;
+        timer->armed = entry;
+        entry->armed = true;
+    }
+    pthread_cond_broadcast(&timer->cond);
+    pthread_mutex_unlock(&timer->lock);
+}
+
+void standby_timer_cancel(struct standby_timer* timer, struct standby_timer_entry* entry) {
+    pthread_mutex_lock(&timer->lock);
+    if (entry->armed) {
+        standby_timer_unlink_l(timer, entry);
+    }
+    while (timer->running == entry) {
+        pthread_cond_wait(&timer->cond, &timer->lock);
+    }
+    pthread_mutex_unlock(&timer->lock);
+}
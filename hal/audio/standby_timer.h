@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Deferred PCM work, off the audio threads.
+ *
+ * Opening a PCM costs far more than restarting a prepared one, and short sounds put streams in
+ * and out of standby all the time. Standby therefore only stops the PCM and arms a timer; the
+ * PCM is closed when the timer fires, unless the stream was resumed in the meantime. Output
+ * rerouting also uses it to open the new port, and close the old one, without blocking the
+ * writer.
+ *
+ * One thread serves all timers of the device. Callbacks run on it with no timer lock held, and
+ * must check for themselves that closing is still due: a timer is not disarmed when its stream
+ * resumes, it simply finds nothing to do.
+ */
+
+#ifndef STANDBY_TIMER_H
+#define STANDBY_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef void (*standby_timer_callback_t)(void* context);
+
+/* Owned by the object being timed, and only touched by the timer once armed. */
+struct standby_timer_entry {
+    standby_timer_callback_t callback;
+    void* context;
+    uint64_t deadline_nsec;
+    bool armed;
+    struct standby_timer_entry* next;
+};
+
+struct standby_timer;
+
+/* Start the timer thread. Returns NULL on failure. */
+struct standby_timer* standby_timer_init(void);
+/* Stop the timer thread. Entries still armed are dropped without their callback. */
+void standby_timer_release(struct standby_timer* timer);
+
+void standby_timer_entry_init(struct standby_timer_entry* entry,
+                              standby_timer_callback_t callback, void* context);
+/* Call the entry's callback in 'delay_ms', replacing any earlier deadline it had. Does not
+ * block, so it may be called with the locks the callback takes. */
+void standby_timer_arm(struct standby_timer* timer, struct standby_timer_entry* entry,
+                       uint32_t delay_ms);
+/* Disarm the entry, waiting for its callback to return if it is running, so the entry and its
+ * context may be freed afterwards. Must not be called with any lock the callback takes. */
+void standby_timer_cancel(struct standby_timer* timer, struct standby_timer_entry* entry);
+
+#endif /* #ifndef STANDBY_TIMER_H */
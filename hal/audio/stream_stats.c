@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_stream_stats"
+//#define LOG_NDEBUG 0
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "stream_stats.h"
+
+#define STATS_LOAD(counter) atomic_load_explicit(&(counter), memory_order_relaxed)
+
+/* Only the owning thread writes, so a plain read-modify-write is enough and avoids a locked
+ * instruction on the audio path. */
+static void stats_add(atomic_uint_fast64_t* counter, uint64_t value) {
+    atomic_store_explicit(counter, STATS_LOAD(*counter) + value, memory_order_relaxed);
+}
+
+static void stats_max(atomic_uint_fast64_t* counter, uint64_t value) {
+    if (value > STATS_LOAD(*counter)) {
+        atomic_store_explicit(counter, value, memory_order_relaxed);
+    }
+}
+
+void stream_stats_init(stream_stats_t* stats) {
+    atomic_init(&stats->frames, 0);
+    atomic_init(&stats->xruns, 0);
+    atomic_init(&stats->io_errors, 0);
+    atomic_init(&stats->io_calls, 0);
+    atomic_init(&stats->io_nsec, 0);
+    atomic_init(&stats->io_max_nsec, 0);
+    atomic_init(&stats->dsp_calls, 0);
+    atomic_init(&stats->dsp_nsec, 0);
+    atomic_init(&stats->dsp_max_nsec, 0);
+    for (int i = 0; i < STREAM_STATS_HISTOGRAM_BUCKETS; i++) {
+        atomic_init(&stats->latency[i], 0);
+    }
+}
+
+void stream_stats_add_io(stream_stats_t* stats, uint64_t nsec, uint64_t frames, bool failed) {
+    stats_add(&stats->io_calls, 1);
+    stats_add(&stats->io_nsec, nsec);
+    stats_max(&stats->io_max_nsec, nsec);
+    if (failed) {
+        stats_add(&stats->io_errors, 1);
+    } else {
+        stats_add(&stats->frames, frames);
+    }
+}
+
+void stream_stats_add_xrun(stream_stats_t* stats) {
+    stats_add(&stats->xruns, 1);
+}
+
+void stream_stats_add_dsp(stream_stats_t* stats, uint64_t nsec) {
+    stats_add(&stats->dsp_calls, 1);
+    stats_add(&stats->dsp_nsec, nsec);
+    stats_max(&stats->dsp_max_nsec, nsec);
+}
+
+void stream_stats_add_latency(stream_stats_t* stats, uint64_t nsec) {
+    uint64_t units = nsec / (STREAM_STATS_HISTOGRAM_BASE_USEC * 1000);
+    int bucket = (units == 0) ? 0 : 64 - __builtin_clzll(units);
+    if (bucket >= STREAM_STATS_HISTOGRAM_BUCKETS) {
+        bucket = STREAM_STATS_HISTOGRAM_BUCKETS - 1;
+    }
+    stats_add(&stats->latency[bucket], 1);
+}
+
+static void stats_dump_time(int fd, int indent, const char* name, uint64_t calls, uint64_t nsec,
+                            uint64_t max_nsec) {
+    dprintf(fd, "%*s%s: %" PRIu64 " calls, total %" PRIu64 " ms, avg %" PRIu64 " us, max %" PRIu64
+            " us\n", indent, "", name, calls, nsec / 1000000, (calls > 0) ? nsec / calls / 1000 : 0,
+            max_nsec / 1000);
+}
+
+void stream_stats_dump(const stream_stats_t* stats, int fd, int indent, const char* dsp_name,
+                       const char* latency_name) {
+    dprintf(fd, "%*sFrames: %" PRIu64 "\n", indent, "", STATS_LOAD(stats->frames));
+    dprintf(fd, "%*sXruns: %" PRIu64 "\n", indent, "", STATS_LOAD(stats->xruns));
+    dprintf(fd, "%*sI/O errors: %" PRIu64 "\n", indent, "", STATS_LOAD(stats->io_errors));
+    stats_dump_time(fd, indent, "Blocked in I/O", STATS_LOAD(stats->io_calls),
+                    STATS_LOAD(stats->io_nsec), STATS_LOAD(stats->io_max_nsec));
+    if (dsp_name != NULL) {
+        stats_dump_time(fd, indent, dsp_name, STATS_LOAD(stats->dsp_calls),
+                        STATS_LOAD(stats->dsp_nsec), STATS_LOAD(stats->dsp_max_nsec));
+    }
+    if (latency_name == NULL) {
+        return;
+    }
+    dprintf(fd, "%*s%s latency:\n", indent, "", latency_name);
+    uint64_t low_usec = 0;
+    uint64_t high_usec = STREAM_STATS_HISTOGRAM_BASE_USEC;
+    for (int i = 0; i < STREAM_STATS_HISTOGRAM_BUCKETS; i++) {
+        uint64_t count = STATS_LOAD(stats->latency[i]);
+        if (i == STREAM_STATS_HISTOGRAM_BUCKETS - 1) {
+            dprintf(fd, "%*s  >= %" PRIu64 " us: %" PRIu64 "\n", indent, "", low_usec, count);
+        } else {
+            dprintf(fd, "%*s  %" PRIu64 "-%" PRIu64 " us: %" PRIu64 "\n", indent, "", low_usec,
+                    high_usec, count);
+        }
+        low_usec = high_usec;
+        high_usec *= 2;
+    }
+}
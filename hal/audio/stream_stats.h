@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Per-stream performance counters for dumpsys. Each set of counters is updated by a single
+ * thread (the one doing the stream I/O) with relaxed atomics, so recording is lock-free and
+ * dump() may read them at any time from another thread.
+ *
+ * I/O time is how long the thread was blocked in the PCM (or capture hub) call, DSP time is
+ * spent in EQ or AEC. High DSP time points at CPU starvation, high I/O time with normal DSP time
+ * at the driver.
+ */
+
+#ifndef STREAM_STATS_H
+#define STREAM_STATS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Latency histogram: bucket 0 is below STREAM_STATS_HISTOGRAM_BASE_USEC, each next one twice as
+ * wide as the previous, the last one open ended (>= 512 ms). */
+#define STREAM_STATS_HISTOGRAM_BUCKETS 13
+#define STREAM_STATS_HISTOGRAM_BASE_USEC 250
+
+typedef struct stream_stats {
+    atomic_uint_fast64_t frames;
+    atomic_uint_fast64_t xruns;
+    atomic_uint_fast64_t io_errors;
+    atomic_uint_fast64_t io_calls;
+    atomic_uint_fast64_t io_nsec;
+    atomic_uint_fast64_t io_max_nsec;
+    atomic_uint_fast64_t dsp_calls;
+    atomic_uint_fast64_t dsp_nsec;
+    atomic_uint_fast64_t dsp_max_nsec;
+    atomic_uint_fast64_t latency[STREAM_STATS_HISTOGRAM_BUCKETS];
+} stream_stats_t;
+
+void stream_stats_init(stream_stats_t* stats);
+
+/* One PCM call that blocked for 'nsec' and moved 'frames' frames, 0 if it failed. */
+void stream_stats_add_io(stream_stats_t* stats, uint64_t nsec, uint64_t frames, bool failed);
+void stream_stats_add_xrun(stream_stats_t* stats);
+/* One run of the stream's EQ or AEC. */
+void stream_stats_add_dsp(stream_stats_t* stats, uint64_t nsec);
+void stream_stats_add_latency(stream_stats_t* stats, uint64_t nsec);
+
+/* Print the counters to 'fd', 'indent' spaces in. 'dsp_name' and 'latency_name' label the DSP
+ * time and the latency histogram. */
+void stream_stats_dump(const stream_stats_t* stats, int fd, int indent, const char* dsp_name,
+                       const char* latency_name);
+
+#endif /* #ifndef STREAM_STATS_H */
@@ -67,6 +67,12 @@ GRALLOC_DISP_W?=0
 GRALLOC_DISP_H?=0
 # Vsync backend(not used)
 GRALLOC_VSYNC_BACKEND?=default
+# Bytes of freed buffers kept for reuse by the allocator, 0 disables the pool
+GRALLOC_POOL_MAX_KB?=32768
+# Time after which a pooled buffer is closed if not reused
+GRALLOC_POOL_MAX_AGE_MS?=5000
+# Clears reused buffers, as fresh allocations are
+GRALLOC_POOL_ZERO_ON_REUSE?=1
 
 # HAL module implemenation, not prelinked and stored in
 # hw/<OVERLAY_HARDWARE_MODULE_ID>.<ro.product.board>.so
@@ -144,6 +150,9 @@ LOCAL_CFLAGS += -DGRALLOC_INIT_AFBC=$(GRALLOC_INIT_AFBC)
 LOCAL_CFLAGS += -D$(GRALLOC_DEPTH)
 LOCAL_CFLAGS += -DGRALLOC_FB_SWAP_RED_BLUE=$(GRALLOC_FB_SWAP_RED_BLUE)
 LOCAL_CFLAGS += -DGRALLOC_ARM_NO_EXTERNAL_AFBC=$(GRALLOC_ARM_NO_EXTERNAL_AFBC)
+LOCAL_CFLAGS += -DGRALLOC_POOL_MAX_KB=$(GRALLOC_POOL_MAX_KB)
+LOCAL_CFLAGS += -DGRALLOC_POOL_MAX_AGE_MS=$(GRALLOC_POOL_MAX_AGE_MS)
+LOCAL_CFLAGS += -DGRALLOC_POOL_ZERO_ON_REUSE=$(GRALLOC_POOL_ZERO_ON_REUSE)
 LOCAL_CFLAGS += -DGRALLOC_LIBRARY_BUILD=1
 
 LOCAL_SHARED_LIBRARIES := libhardware liblog libcutils libGLESv1_CM libion libsync libutils
@@ -18,7 +18,11 @@
 
 #include <cutils/ashmem.h>
 #include <log/log.h>
+#include <pthread.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <tuple>
 
 #if GRALLOC_USE_GRALLOC1_API == 1
 #include <hardware/gralloc1.h>
@@ -32,32 +36,29 @@
 #include "gralloc_buffer_priv.h"
 
 /*
- * Allocate shared memory for attribute storage. Only to be
- * used by gralloc internally.
+ * The attribute regions of the buffers of one allocation request are packed
+ * into a page of their own, in slots handed out in order. Buffers of different
+ * requests never share a page: importers may write attributes, so every
+ * importer of a buffer can map its page writable. Each handle carries its own
+ * fd for the page, as the handle layout requires.
  *
- * Return 0 on success.
+ * This only saves the region creation and clearing for the second and later
+ * buffers of a request. A single-buffer allocation, the common case, still
+ * costs one page and one fd, as it did before packing.
  */
-int gralloc_buffer_attr_allocate(private_handle_t *hnd)
-{
-	int rval = -1;
-
-	if (!hnd)
-	{
-		goto out;
-	}
+#define ATTR_SLOTS_PER_PAGE (PAGE_SIZE / GRALLOC_ATTR_SLOT_SIZE)
 
-	if (hnd->share_attr_fd >= 0)
-	{
-		ALOGW("Warning share attribute fd already exists during create. Closing.");
-		close(hnd->share_attr_fd);
-	}
+static int attr_page_create(void)
+{
+	void *base;
+	int fd;
 
-	hnd->share_attr_fd = ashmem_create_region("gralloc_shared_attr", PAGE_SIZE);
+	fd = ashmem_create_region("gralloc_shared_attr", PAGE_SIZE);
 
-	if (hnd->share_attr_fd < 0)
+	if (fd < 0)
 	{
 		ALOGE("Failed to allocate page for shared attribute region");
-		goto err_ashmem;
+		return -1;
 	}
 
 	/*
@@ -73,39 +74,74 @@ int gralloc_buffer_attr_allocate(private_handle_t *hnd)
 	 * Because of this we keep the PROT_EXEC flag.
 	 */
 
-	hnd->attr_base = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, hnd->share_attr_fd, 0);
+	base = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 
-	if (hnd->attr_base != MAP_FAILED)
-	{
-		/* The attribute region contains signed integers only.
-		 * The reason for this is because we can set a value less than 0 for
-		 * not-initialized values.
-		 */
-		attr_region *region = (attr_region *)hnd->attr_base;
-
-		memset(hnd->attr_base, 0xff, PAGE_SIZE);
-		munmap(hnd->attr_base, PAGE_SIZE);
-		hnd->attr_base = MAP_FAILED;
-	}
-	else
+	if (base == MAP_FAILED)
 	{
 		ALOGE("Failed to mmap shared attribute region");
-		goto err_ashmem;
+		close(fd);
+		return -1;
 	}
 
-	rval = 0;
-	goto out;
+	/* The attribute region contains signed integers only.
+	 * The reason for this is because we can set a value less than 0 for
+	 * not-initialized values.
+	 */
+	memset(base, 0xff, PAGE_SIZE);
+	munmap(base, PAGE_SIZE);
 
-err_ashmem:
+	return fd;
+}
 
-	if (hnd->share_attr_fd >= 0)
+/*
+ * Allocate shared memory for attribute storage of the num_hnds
+ * buffers of one allocation request. Only to be used by gralloc
+ * internally.
+ *
+ * Return 0 on success.
+ */
+int gralloc_buffer_attr_allocate(buffer_handle_t *pHandle, uint32_t num_hnds)
+{
+	int page_fd = -1;
+	uint32_t i;
+
+	for (i = 0; i < num_hnds; i++)
 	{
-		close(hnd->share_attr_fd);
-		hnd->share_attr_fd = -1;
+		private_handle_t *hnd = (private_handle_t *)pHandle[i];
+		uint32_t slot = i % ATTR_SLOTS_PER_PAGE;
+
+		if (!hnd)
+		{
+			return -1;
+		}
+
+		if (hnd->share_attr_fd >= 0)
+		{
+			ALOGW("Warning share attribute fd already exists during create. Closing.");
+			close(hnd->share_attr_fd);
+			hnd->share_attr_fd = -1;
+		}
+
+		if (slot == 0)
+		{
+			page_fd = attr_page_create();
+			hnd->share_attr_fd = page_fd;
+		}
+		else
+		{
+			hnd->share_attr_fd = dup(page_fd);
+		}
+
+		if (hnd->share_attr_fd < 0)
+		{
+			ALOGE("Failed to get shared attribute region fd");
+			return -1;
+		}
+
+		hnd->attr_offset = slot * GRALLOC_ATTR_SLOT_SIZE;
 	}
 
-out:
-	return rval;
+	return 0;
 }
 
 /*
@@ -131,9 +167,7 @@ int gralloc_buffer_attr_free(private_handle_t *hnd)
 
 	if (hnd->attr_base != MAP_FAILED)
 	{
-		ALOGW("Warning shared attribute region mapped at free. Unmapping");
-		munmap(hnd->attr_base, PAGE_SIZE);
-		hnd->attr_base = MAP_FAILED;
+		gralloc_buffer_attr_unmap(hnd);
 	}
 
 	close(hnd->share_attr_fd);
@@ -143,3 +177,169 @@ int gralloc_buffer_attr_free(private_handle_t *hnd)
 out:
 	return rval;
 }
+
+/*
+ * Attribute mappings are cached per process and kept until the buffer is
+ * freed, so that attribute accesses after the first one are plain memory
+ * accesses. Read-only and writable mappings are cached separately. Buffers of
+ * the same attribute page share its mapping when the page has an inode of its
+ * own, as memfd backed ashmem does. Legacy ashmem fds all show the inode of
+ * the device, their mappings are cached per fd.
+ */
+struct attr_mapping
+{
+	void *base;
+	uint32_t refs;
+};
+
+/* Device, inode, fd or -1, protection */
+typedef std::tuple<dev_t, ino_t, int, int> attr_mapping_key;
+
+static pthread_mutex_t attr_mapping_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<attr_mapping_key, attr_mapping> attr_mappings;
+
+static int attr_mapping_get_key(int fd, int prot, attr_mapping_key *key)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+	{
+		return -1;
+	}
+
+	*key = std::make_tuple(st.st_dev, st.st_ino, S_ISREG(st.st_mode) ? -1 : fd, prot);
+	return 0;
+}
+
+static std::map<attr_mapping_key, attr_mapping>::iterator attr_mapping_find_locked(void *base)
+{
+	auto it = attr_mappings.begin();
+
+	while (it != attr_mappings.end() && it->second.base != base)
+	{
+		it++;
+	}
+
+	return it;
+}
+
+static void attr_mapping_put_locked(private_handle_t *hnd)
+{
+	auto it = attr_mapping_find_locked(hnd->attr_base);
+
+	if (it != attr_mappings.end() && --it->second.refs == 0)
+	{
+		munmap(it->second.base, PAGE_SIZE);
+		attr_mappings.erase(it);
+	}
+
+	hnd->attr_base = MAP_FAILED;
+}
+
+/*
+ * Map the attribute storage area before attempting to
+ * read/write from it. A buffer mapped read-only is mapped
+ * again when it is asked for a writable mapping.
+ *
+ * Return 0 on success.
+ */
+int gralloc_buffer_attr_map(private_handle_t *hnd, int readwrite)
+{
+	int prot_flags = PROT_READ;
+	attr_mapping_key key;
+	int rval = -1;
+
+	if (!hnd)
+	{
+		return rval;
+	}
+
+	if (hnd->share_attr_fd < 0)
+	{
+		ALOGE("Shared attribute region not available to be mapped");
+		return rval;
+	}
+
+	if (hnd->attr_offset > PAGE_SIZE - GRALLOC_ATTR_SLOT_SIZE)
+	{
+		ALOGE("Invalid shared attribute region offset %" PRIu64, hnd->attr_offset);
+		return rval;
+	}
+
+	if (readwrite)
+	{
+		prot_flags |= PROT_WRITE;
+	}
+
+	pthread_mutex_lock(&attr_mapping_lock);
+
+	if (hnd->attr_base != MAP_FAILED)
+	{
+		auto current = attr_mapping_find_locked(hnd->attr_base);
+
+		if (!readwrite || (current != attr_mappings.end() && (std::get<3>(current->first) & PROT_WRITE)))
+		{
+			rval = 0;
+			goto out;
+		}
+
+		attr_mapping_put_locked(hnd);
+	}
+
+	if (attr_mapping_get_key(hnd->share_attr_fd, prot_flags, &key) < 0)
+	{
+		ALOGE("Failed to stat shared attribute region err=%s", strerror(errno));
+		goto out;
+	}
+
+	{
+		auto it = attr_mappings.find(key);
+
+		if (it == attr_mappings.end())
+		{
+			void *base = mmap(NULL, PAGE_SIZE, prot_flags, MAP_SHARED, hnd->share_attr_fd, 0);
+
+			if (base == MAP_FAILED)
+			{
+				ALOGE("Failed to mmap shared attribute region err=%s", strerror(errno));
+				goto out;
+			}
+
+			it = attr_mappings.emplace(key, attr_mapping{ base, 0 }).first;
+		}
+
+		it->second.refs++;
+		hnd->attr_base = it->second.base;
+		rval = 0;
+	}
+
+out:
+	pthread_mutex_unlock(&attr_mapping_lock);
+	return rval;
+}
+
+/*
+ * Unmap the attribute storage area when done with it.
+ *
+ * Return 0 on success.
+ */
+int gralloc_buffer_attr_unmap(private_handle_t *hnd)
+{
+	int rval = -1;
+
+	if (!hnd)
+	{
+		return rval;
+	}
+
+	pthread_mutex_lock(&attr_mapping_lock);
+
+	if (hnd->attr_base != MAP_FAILED)
+	{
+		attr_mapping_put_locked(hnd);
+		rval = 0;
+	}
+
+	pthread_mutex_unlock(&attr_mapping_lock);
+	return rval;
+}
@@ -21,6 +21,7 @@
 
 #include "gralloc_priv.h"
 #include <errno.h>
+#include <inttypes.h>
 #include <string.h>
 #include "mali_gralloc_private_interface_types.h"
 
@@ -39,13 +40,17 @@ struct attr_region
 
 typedef struct attr_region attr_region;
 
+/* Regions of one allocation request share a page, see gralloc_buffer_attr_allocate() */
+#define GRALLOC_ATTR_SLOT_SIZE GRALLOC_ALIGN(sizeof(attr_region), 8)
+
 /*
- * Allocate shared memory for attribute storage. Only to be
- * used by gralloc internally.
+ * Allocate shared memory for attribute storage of the num_hnds
+ * buffers of one allocation request. Only to be used by gralloc
+ * internally.
  *
  * Return 0 on success.
  */
-int gralloc_buffer_attr_allocate(struct private_handle_t *hnd);
+int gralloc_buffer_attr_allocate(buffer_handle_t *pHandle, uint32_t num_hnds);
 
 /*
  * Frees the shared memory allocated for attribute storage.
@@ -57,70 +62,25 @@ int gralloc_buffer_attr_free(struct private_handle_t *hnd);
 
 /*
  * Map the attribute storage area before attempting to
- * read/write from it.
+ * read/write from it, writable only if readwrite is set.
+ * The mapping is kept, and shared with the buffers allocated
+ * along with it, until the buffer is freed or
+ * gralloc_buffer_attr_unmap() is called.
  *
  * Return 0 on success.
  */
-static inline int gralloc_buffer_attr_map(struct private_handle_t *hnd, int readwrite)
-{
-	int rval = -1;
-	int prot_flags = PROT_READ;
-
-	if (!hnd)
-	{
-		goto out;
-	}
-
-	if (hnd->share_attr_fd < 0)
-	{
-		ALOGE("Shared attribute region not available to be mapped");
-		goto out;
-	}
-
-	if (readwrite)
-	{
-		prot_flags |= PROT_WRITE;
-	}
-
-	hnd->attr_base = mmap(NULL, PAGE_SIZE, prot_flags, MAP_SHARED, hnd->share_attr_fd, 0);
-
-	if (hnd->attr_base == MAP_FAILED)
-	{
-		ALOGE("Failed to mmap shared attribute region err=%s", strerror(errno));
-		goto out;
-	}
-
-	rval = 0;
-
-out:
-	return rval;
-}
+int gralloc_buffer_attr_map(struct private_handle_t *hnd, int readwrite);
 
 /*
  * Unmap the attribute storage area when done with it.
  *
  * Return 0 on success.
  */
-static inline int gralloc_buffer_attr_unmap(struct private_handle_t *hnd)
-{
-	int rval = -1;
-
-	if (!hnd)
-	{
-		goto out;
-	}
+int gralloc_buffer_attr_unmap(struct private_handle_t *hnd);
 
-	if (hnd->attr_base != MAP_FAILED)
-	{
-		if (munmap(hnd->attr_base, PAGE_SIZE) == 0)
-		{
-			hnd->attr_base = MAP_FAILED;
-			rval = 0;
-		}
-	}
-
-out:
-	return rval;
+static inline attr_region *gralloc_buffer_attr_region(struct private_handle_t *hnd)
+{
+	return (attr_region *)((uintptr_t)hnd->attr_base + hnd->attr_offset);
 }
 
 /*
@@ -139,7 +99,7 @@ static inline int gralloc_buffer_attr_write(struct private_handle_t *hnd, buf_at
 
 	if (hnd->attr_base != MAP_FAILED)
 	{
-		attr_region *region = (attr_region *)hnd->attr_base;
+		attr_region *region = gralloc_buffer_attr_region(hnd);
 
 		switch (attr)
 		{
@@ -175,7 +135,7 @@ static inline int gralloc_buffer_attr_read(struct private_handle_t *hnd, buf_att
 
 	if (hnd->attr_base != MAP_FAILED)
 	{
-		attr_region *region = (attr_region *)hnd->attr_base;
+		attr_region *region = gralloc_buffer_attr_region(hnd);
 
 		switch (attr)
 		{
@@ -86,7 +86,7 @@ static int alloc_device_alloc(alloc_device_t *dev, int w, int h, int format, int
 			 *
 			 * Explicitly ignore allocation errors since it is not critical to have
 			 */
-			(void)gralloc_buffer_attr_allocate(hnd);
+			(void)gralloc_buffer_attr_allocate(pHandle, 1);
 
 			hnd->req_format = format;
 			hnd->yuv_info = MALI_YUV_BT601_NARROW;
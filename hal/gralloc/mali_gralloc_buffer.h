@@ -136,7 +136,7 @@ struct private_handle_t
 	uint64_t producer_usage;
 	uint64_t backing_store_id;
 	int backing_store_size;
-	int writeOwner;
+	int lock_usage; /* CPU usage of the outstanding locks, in this process */
 	int allocating_pid;
 	int remote_pid;
 	int ref_count;
@@ -167,8 +167,14 @@ struct private_handle_t
 	// for request width and height
 	uint32_t req_width;
 	uint32_t req_height;
-	uint64_t padding_1;
-	uint64_t padding_2;
+
+	/*
+	 * The attribute regions of the buffers of one allocation request share
+	 * one page: attr_offset locates this buffer's region in the page of
+	 * share_attr_fd.
+	 */
+	uint64_t attr_offset;
+	uint64_t lock_count; /* Outstanding locks, in this process */
 
 #ifdef __cplusplus
 	/*
@@ -198,7 +204,7 @@ struct private_handle_t
 	    , producer_usage(_producer_usage)
 	    , backing_store_id(0x0)
 	    , backing_store_size(0)
-	    , writeOwner(0)
+	    , lock_usage(0)
 	    , allocating_pid(getpid())
 	    , remote_pid(-1)
 	    , ref_count(1)
@@ -206,6 +212,8 @@ struct private_handle_t
 	    , yuv_info(MALI_YUV_NO_INFO)
 	    , fd(fb_file)
 	    , offset(fb_offset)
+	    , attr_offset(0)
+	    , lock_count(0)
 	{
 		version = sizeof(native_handle);
 		numFds = sNumFds;
@@ -235,7 +243,7 @@ struct private_handle_t
 	    , producer_usage(_producer_usage)
 	    , backing_store_id(0x0)
 	    , backing_store_size(_backing_store_size)
-	    , writeOwner(0)
+	    , lock_usage(0)
 	    , allocating_pid(getpid())
 	    , remote_pid(-1)
 	    , ref_count(1)
@@ -244,6 +252,8 @@ struct private_handle_t
 	    , fd(-1)
 	    , offset(0)
 	    , min_pgsz(_min_pgsz)
+	    , attr_offset(0)
+	    , lock_count(0)
 	{
 		version = sizeof(native_handle);
 		numFds = sNumFds;
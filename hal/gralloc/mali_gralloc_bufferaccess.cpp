@@ -17,6 +17,7 @@
  */
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #if GRALLOC_USE_GRALLOC1_API == 1
 #include <hardware/gralloc1.h>
@@ -33,10 +34,119 @@
 #include "gralloc_helper.h"
 #include <sync/sync.h>
 
+/*
+ * A buffer may be locked several times at once, from several threads. Every
+ * lock of an ION buffer is counted in lock_count, and the CPU usage of the
+ * outstanding locks is accumulated in lock_usage. The CPU access starts for
+ * the usage the buffer is not accessed with yet, and ends when the last lock is
+ * unlocked.
+ *
+ * s_lock_count_lock only covers these fields. The DMA_BUF_SYNC ioctls may wait
+ * for the fences of the buffer, so they are issued without it, with
+ * LOCK_COUNT_SYNCING set in lock_count meanwhile. Other lockers and unlockers
+ * of that buffer wait on s_lock_sync_cond until it is cleared.
+ */
+#define LOCK_COUNT_SYNCING (1ULL << 63)
+
+static pthread_mutex_t s_lock_count_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_lock_sync_cond = PTHREAD_COND_INITIALIZER;
+
+/* Called with s_lock_count_lock held, returns with it held */
+static void lock_wait_sync_locked(private_handle_t *hnd)
+{
+	while (hnd->lock_count & LOCK_COUNT_SYNCING)
+	{
+		pthread_cond_wait(&s_lock_sync_cond, &s_lock_count_lock);
+	}
+}
+
+/* Called with s_lock_count_lock held and LOCK_COUNT_SYNCING set by the caller, returns with it held and cleared */
+static void lock_sync_locked(const mali_gralloc_module *m, private_handle_t *hnd, int usage, bool start)
+{
+	pthread_mutex_unlock(&s_lock_count_lock);
+
+	if (start)
+	{
+		mali_gralloc_ion_sync_start(m, hnd, usage);
+	}
+	else
+	{
+		mali_gralloc_ion_sync_end(m, hnd, usage);
+	}
+
+	pthread_mutex_lock(&s_lock_count_lock);
+	hnd->lock_count &= ~LOCK_COUNT_SYNCING;
+	pthread_cond_broadcast(&s_lock_sync_cond);
+}
+
+/*
+ * Maps the buffer on its first lock for CPU access and makes its contents
+ * visible to the CPU for the access requested.
+ */
+static int lock_begin_cpu_access(const mali_gralloc_module *m, private_handle_t *hnd, uint64_t usage)
+{
+	int cpu_usage = usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK);
+
+	if (!(hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION))
+	{
+		return 0;
+	}
+
+	if (cpu_usage && mali_gralloc_ion_map_lazy(hnd) < 0)
+	{
+		AERR("Failed to map buffer %p for CPU access", hnd);
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&s_lock_count_lock);
+	lock_wait_sync_locked(hnd);
+
+	hnd->lock_count++;
+
+	/* Usage already started by an outstanding lock needs no sync */
+	int new_usage = cpu_usage & ~hnd->lock_usage;
+
+	if (new_usage)
+	{
+		hnd->lock_usage |= new_usage;
+		hnd->lock_count |= LOCK_COUNT_SYNCING;
+		lock_sync_locked(m, hnd, new_usage, true);
+	}
+
+	pthread_mutex_unlock(&s_lock_count_lock);
+	return 0;
+}
+
+/* Ends the CPU access of the buffer if this was its last outstanding lock */
+static void lock_end_cpu_access(const mali_gralloc_module *m, private_handle_t *hnd)
+{
+	if (!(hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION))
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&s_lock_count_lock);
+	lock_wait_sync_locked(hnd);
+
+	if (0 == hnd->lock_count)
+	{
+		AWAR("Unlocking buffer %p that is not locked", hnd);
+	}
+	else if (0 == --hnd->lock_count && hnd->lock_usage)
+	{
+		int lock_usage = hnd->lock_usage;
+
+		hnd->lock_usage = 0;
+		hnd->lock_count |= LOCK_COUNT_SYNCING;
+		lock_sync_locked(m, hnd, lock_usage, false);
+	}
+
+	pthread_mutex_unlock(&s_lock_count_lock);
+}
+
 int mali_gralloc_lock(const mali_gralloc_module *m, buffer_handle_t buffer, uint64_t usage, int l, int t, int w, int h,
                       void **vaddr)
 {
-	GRALLOC_UNUSED(m);
 	GRALLOC_UNUSED(l);
 	GRALLOC_UNUSED(t);
 	GRALLOC_UNUSED(w);
@@ -56,9 +166,9 @@ int mali_gralloc_lock(const mali_gralloc_module *m, buffer_handle_t buffer, uint
 		return -EINVAL;
 	}
 
-	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION)
+	if (lock_begin_cpu_access(m, hnd, usage) < 0)
 	{
-		hnd->writeOwner = usage & GRALLOC_USAGE_SW_WRITE_MASK;
+		return -EINVAL;
 	}
 
 	if (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK))
@@ -72,7 +182,6 @@ int mali_gralloc_lock(const mali_gralloc_module *m, buffer_handle_t buffer, uint
 int mali_gralloc_lock_ycbcr(const mali_gralloc_module *m, buffer_handle_t buffer, uint64_t usage, int l, int t, int w,
                             int h, android_ycbcr *ycbcr)
 {
-	GRALLOC_UNUSED(m);
 	GRALLOC_UNUSED(l);
 	GRALLOC_UNUSED(t);
 	GRALLOC_UNUSED(w);
@@ -91,9 +200,9 @@ int mali_gralloc_lock_ycbcr(const mali_gralloc_module *m, buffer_handle_t buffer
 
 	private_handle_t *hnd = (private_handle_t *)buffer;
 
-	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION)
+	if (lock_begin_cpu_access(m, hnd, usage) < 0)
 	{
-		hnd->writeOwner = usage & GRALLOC_USAGE_SW_WRITE_MASK;
+		return -EINVAL;
 	}
 
 	if (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK) &&
@@ -146,6 +255,7 @@ int mali_gralloc_lock_ycbcr(const mali_gralloc_module *m, buffer_handle_t buffer
 
 		default:
 			AERR("Can't lock buffer %p: wrong format %" PRIx64, hnd, hnd->internal_format);
+			lock_end_cpu_access(m, hnd);
 			return -EINVAL;
 		}
 
@@ -159,6 +269,7 @@ int mali_gralloc_lock_ycbcr(const mali_gralloc_module *m, buffer_handle_t buffer
 	else
 	{
 		AERR("Don't support to lock buffer %p: with format %" PRIx64, hnd, hnd->internal_format);
+		lock_end_cpu_access(m, hnd);
 		return -EINVAL;
 	}
 
@@ -175,11 +286,7 @@ int mali_gralloc_unlock(const mali_gralloc_module *m, buffer_handle_t buffer)
 
 	private_handle_t *hnd = (private_handle_t *)buffer;
 
-	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION && hnd->writeOwner)
-	{
-		mali_gralloc_ion_sync(m, hnd);
-	}
-
+	lock_end_cpu_access(m, hnd);
 	return 0;
 }
 
@@ -248,7 +355,6 @@ int mali_gralloc_lock_ycbcr_async(const mali_gralloc_module *m, buffer_handle_t
 int mali_gralloc_lock_flex_async(const mali_gralloc_module *m, buffer_handle_t buffer, uint64_t usage, int l, int t,
                                  int w, int h, struct android_flex_layout *flex_layout, int32_t fence_fd)
 {
-	GRALLOC_UNUSED(m);
 	GRALLOC_UNUSED(l);
 	GRALLOC_UNUSED(t);
 	GRALLOC_UNUSED(w);
@@ -273,9 +379,9 @@ int mali_gralloc_lock_flex_async(const mali_gralloc_module *m, buffer_handle_t b
 
 	private_handle_t *hnd = (private_handle_t *)buffer;
 
-	if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION)
+	if (lock_begin_cpu_access(m, hnd, usage) < 0)
 	{
-		hnd->writeOwner = usage & GRALLOC_USAGE_SW_WRITE_MASK;
+		return -EINVAL;
 	}
 
 	if (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK) &&
@@ -388,12 +494,14 @@ int mali_gralloc_lock_flex_async(const mali_gralloc_module *m, buffer_handle_t b
 
 		default:
 			AERR("Can't lock buffer %p: wrong format %" PRIx64, hnd, hnd->internal_format);
+			lock_end_cpu_access(m, hnd);
 			return -EINVAL;
 		}
 	}
 	else
 	{
 		AERR("Don't support to lock buffer %p: with format %" PRIx64, hnd, hnd->internal_format);
+		lock_end_cpu_access(m, hnd);
 		return -EINVAL;
 	}
 
@@ -1190,6 +1190,17 @@ int mali_gralloc_buffer_allocate(mali_gralloc_module *m, const gralloc_buffer_de
 		backing_store_id = getUniqueId();
 	}
 
+	err = gralloc_buffer_attr_allocate(pHandle, numDescriptors);
+
+	if (err < 0)
+	{
+		ALOGE("gralloc_buffer_attr_allocate return error");
+		/* free all allocated ion buffer& attr buffer here.*/
+		mali_gralloc_buffer_free_internal(pHandle, numDescriptors);
+		delete []req_wh;
+		return err;
+	}
+
 	for (i = 0; i < numDescriptors; i++)
 	{
 		buffer_descriptor_t *bufDescriptor = (buffer_descriptor_t *)descriptors[i];
@@ -1197,17 +1208,6 @@ int mali_gralloc_buffer_allocate(mali_gralloc_module *m, const gralloc_buffer_de
 
 		usage = bufDescriptor->consumer_usage | bufDescriptor->producer_usage;
 
-		err = gralloc_buffer_attr_allocate(hnd);
-
-		if (err < 0)
-		{
-			ALOGE("gralloc_buffer_attr_allocate return error");
-			/* free all allocated ion buffer& attr buffer here.*/
-			mali_gralloc_buffer_free_internal(pHandle, numDescriptors);
-			delete []req_wh;
-			return err;
-		}
-
 		mali_gralloc_dump_buffer_add(hnd);
 
 		switch (usage & MALI_GRALLOC_USAGE_YUV_CONF_MASK)
@@ -31,6 +31,7 @@
 #include "mali_gralloc_module.h"
 #include "gralloc_priv.h"
 #include "mali_gralloc_debug.h"
+#include "mali_gralloc_ion.h"
 
 static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
 static std::vector<private_handle_t *> dump_buffers;
@@ -105,6 +106,28 @@ void mali_gralloc_dump_buffers(android::String8 &dumpStrings, uint32_t *outSize)
 	mali_gralloc_dump_string(
 	    dumpStrings, "---------------------End dump Gralloc buffers info with num %zu----------------------\n", num);
 
+	struct mali_gralloc_ion_pool_stats pool;
+	uint64_t requests;
+
+	mali_gralloc_ion_pool_get_stats(&pool);
+	requests = pool.hits + pool.misses;
+	if (pool.enabled)
+	{
+		mali_gralloc_dump_string(dumpStrings,
+		                         "Buffer pool: %" PRIu64 " hits / %" PRIu64 " allocations (%" PRIu64 "%%), %" PRIu64
+		                         " trimmed\n",
+		                         pool.hits, requests, requests ? pool.hits * 100 / requests : 0, pool.trimmed);
+		mali_gralloc_dump_string(dumpStrings,
+		                         "Buffer pool: %zu KB held of %zu KB, %u idle buffers (%zu KB), %u pending (%zu KB)\n",
+		                         (pool.idle_bytes + pool.pending_bytes) / 1024, pool.max_bytes / 1024,
+		                         pool.idle_buffers, pool.idle_bytes / 1024, pool.pending_buffers,
+		                         pool.pending_bytes / 1024);
+	}
+	else
+	{
+		mali_gralloc_dump_string(dumpStrings, "Buffer pool: disabled\n");
+	}
+
 	*outSize = dumpStrings.size();
 }
 
@@ -17,16 +17,23 @@
  */
 
 #include <cstdlib>
+#include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unordered_map>
+#include <vector>
 
 #include <log/log.h>
 #include <cutils/atomic.h>
 
 #include <ion/ion.h>
+#include <linux/dma-buf.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 
 #include <hardware/hardware.h>
 
@@ -44,6 +51,7 @@
 #include "mali_gralloc_formats.h"
 #include "mali_gralloc_usages.h"
 #include "mali_gralloc_bufferdescriptor.h"
+#include "mali_gralloc_ion.h"
 #include "ion_4.12.h"
 #include "dma-heap.h"
 
@@ -52,6 +60,7 @@
 #define ION_CMA        (char*)"linux,cma"
 
 #define DMABUF_SYSTEM	(char*)"system"
+#define DMABUF_SYSTEM_UNCACHED	(char*)"system-uncached"
 #define DMABUF_CMA	(char*)"linux,cma"
 static enum {
 	INTERFACE_UNKNOWN,
@@ -62,6 +71,8 @@ static enum {
 
 static int system_heap_id;
 static int cma_heap_id;
+/* dma-buf heaps only, -1 if the kernel has no uncached system heap */
+static int system_uncached_heap_id = -1;
 
 static void mali_gralloc_ion_free_internal(buffer_handle_t *pHandle, uint32_t num_hnds);
 
@@ -203,8 +214,11 @@ static int alloc_ion_fd(int ion_fd, size_t size, unsigned int heap_mask, unsigne
 	if (interface_ver == INTERFACE_DMABUF_HEAPS) {
 		int fd = system_heap_id;
 		unsigned long flg = 0;
+		/* Buffers the CPU does not access come from the uncached heap, no cache maintenance needed */
 		if (heap_mask == ION_HEAP_TYPE_DMA_MASK)
 			fd = cma_heap_id;
+		else if (!(flags & ION_FLAG_CACHED) && system_uncached_heap_id >= 0)
+			fd = system_uncached_heap_id;
 
 		return dma_heap_alloc(fd, size, flg, shared_fd);
 	}
@@ -219,39 +233,43 @@ static int alloc_ion_fd(int ion_fd, size_t size, unsigned int heap_mask, unsigne
 	return ion_alloc_fd(ion_fd, size, 0, heap, flags, shared_fd);
 }
 
-static int alloc_from_ion_heap(int ion_fd, size_t size, unsigned int heap_mask, unsigned int flags, int *min_pgsz)
+/*
+ * heap_mask and flags are updated to the heap and flags the buffer was
+ * eventually allocated with.
+ */
+static int alloc_from_ion_heap(int ion_fd, size_t size, unsigned int *heap_mask, int *flags, int *min_pgsz)
 {
 	ion_user_handle_t ion_hnd = -1;
-	int shared_fd, ret;
+	int shared_fd = -1, ret;
 
 	if ((interface_ver != INTERFACE_DMABUF_HEAPS) && (ion_fd < 0))
 		return -1;
 
-	if ((size <= 0) || (heap_mask == 0) || (min_pgsz == NULL))
+	if ((size <= 0) || (*heap_mask == 0) || (min_pgsz == NULL))
 		return -1;
 
-	ret = alloc_ion_fd(ion_fd, size, heap_mask, flags, &(shared_fd));
+	ret = alloc_ion_fd(ion_fd, size, *heap_mask, *flags, &(shared_fd));
 	if (ret < 0)
 	{
 #if defined(ION_HEAP_SECURE_MASK)
 
-		if (heap_mask == ION_HEAP_SECURE_MASK)
+		if (*heap_mask == ION_HEAP_SECURE_MASK)
 		{
 			return -1;
 		}
 		else
 #endif
 		{
-			/* If everything else failed try system heap */
-			flags = 0; /* Fallback option flags are not longer valid */
-			heap_mask = ION_HEAP_SYSTEM_MASK;
-			ret = alloc_ion_fd(ion_fd, size, heap_mask, flags, &(shared_fd));
+			/* If everything else failed try system heap, still cached if the CPU accesses the buffer */
+			*flags &= ION_FLAG_CACHED | ION_FLAG_CACHED_NEEDS_SYNC;
+			*heap_mask = ION_HEAP_SYSTEM_MASK;
+			ret = alloc_ion_fd(ion_fd, size, *heap_mask, *flags, &(shared_fd));
 		}
 	}
 
 	if (ret >= 0)
 	{
-		switch (heap_mask)
+		switch (*heap_mask)
 		{
 		case ION_HEAP_SYSTEM_MASK:
 			*min_pgsz = SZ_4K;
@@ -296,6 +314,474 @@ static int alloc_from_ion_heap(int ion_fd, size_t size, unsigned int heap_mask,
 	return shared_fd;
 }
 
+/*
+ * Buffer recycling pool
+ *
+ * Freed buffers are unmapped and their dma-buf fd is kept by the pool instead
+ * of being closed, to be handed out again for a later allocation with the same
+ * heap, flags and size class. The allocator frees its handles as soon as they
+ * have been exported, so a freed buffer is only pending until every other
+ * reference to it (client fds, mappings, device attachments) is gone. The
+ * reference count shown in the dma-buf fdinfo tells when that is the case. The
+ * pool only enables itself once the first buffer allocated, held by nothing but
+ * its fd, reports the expected count. Until then, and for protected buffers,
+ * buffers get their exact size and are not pooled; pooled buffers are rounded
+ * up to their size class.
+ *
+ * Pending and idle buffers both count against GRALLOC_POOL_MAX_KB and are
+ * closed once they have been in the pool for GRALLOC_POOL_MAX_AGE_MS. The
+ * limits are applied on every pool operation, and while the pool is not empty a
+ * trim thread wakes up when its oldest buffer expires, so that an idle process
+ * does not keep them. The thread exits once the pool is empty.
+ */
+#define POOL_MAX_BYTES ((size_t)GRALLOC_POOL_MAX_KB * 1024)
+#define POOL_MAX_AGE_NS ((uint64_t)GRALLOC_POOL_MAX_AGE_MS * 1000000)
+/* Bounds the number of fds held by the pool */
+#define POOL_MAX_BUFFERS 64
+/* Pending buffers checked for a match per allocation */
+#define POOL_MAX_PENDING_CHECKS 4
+/* fdinfo count of an unused buffer: only the pool fd, fdinfo leaves out its own reference */
+#define POOL_UNUSED_FILE_COUNT 1
+
+struct ion_pool_buffer
+{
+	unsigned int heap_mask;
+	int flags;
+	size_t size;
+	int min_pgsz;
+};
+
+struct ion_pool_entry
+{
+	int fd;
+	ion_pool_buffer buf;
+	bool pending;
+	uint64_t release_ns;
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static enum
+{
+	POOL_UNKNOWN,
+	POOL_ENABLED,
+	POOL_DISABLED
+} pool_state = (GRALLOC_POOL_MAX_KB > 0) ? POOL_UNKNOWN : POOL_DISABLED;
+/* Pooled buffers, oldest first */
+static std::vector<ion_pool_entry> pool_entries;
+/* Buffers allocated by the pool and not freed yet, by dma-buf inode */
+static std::unordered_map<ino_t, ion_pool_buffer> pool_live;
+static uint64_t pool_hits;
+static uint64_t pool_misses;
+static uint64_t pool_trimmed;
+static bool pool_trim_thread_running;
+
+static uint64_t pool_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Eight classes per power of two, so that at most 1/8 of a buffer is wasted */
+static size_t pool_size_class(size_t size)
+{
+	size_t step = SZ_4K;
+
+	while ((step << 4) <= size)
+	{
+		step <<= 1;
+	}
+
+	return GRALLOC_ALIGN(size, step);
+}
+
+/* Number of references to the dma-buf of fd, or -1 if unknown */
+static long pool_file_count(int fd)
+{
+	char path[64], info[512];
+	const char *count;
+	ssize_t len;
+	int info_fd;
+
+	snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", fd);
+	info_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (info_fd < 0)
+	{
+		return -1;
+	}
+
+	len = read(info_fd, info, sizeof(info) - 1);
+	close(info_fd);
+	if (len <= 0)
+	{
+		return -1;
+	}
+
+	info[len] = '\0';
+	count = strstr(info, "\ncount:");
+	if (count == NULL)
+	{
+		return -1;
+	}
+
+	return strtol(count + strlen("\ncount:"), NULL, 10);
+}
+
+static int pool_zero(int fd, size_t size)
+{
+	struct dma_buf_sync sync;
+	void *cpu_ptr;
+
+	cpu_ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == cpu_ptr)
+	{
+		AERR("mmap of pooled buffer fd ( %d ) failed with %s", fd, strerror(errno));
+		return -1;
+	}
+
+	sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE;
+	ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+	memset(cpu_ptr, 0, size);
+	sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+	ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+	munmap(cpu_ptr, size);
+	return 0;
+}
+
+static void pool_drop_locked(std::vector<ion_pool_entry>::iterator entry)
+{
+	close(entry->fd);
+	pool_entries.erase(entry);
+	pool_trimmed++;
+}
+
+static void pool_trim_locked(uint64_t now_ns)
+{
+	size_t bytes = 0;
+
+	for (auto it = pool_entries.begin(); it != pool_entries.end();)
+	{
+		if (now_ns - it->release_ns > POOL_MAX_AGE_NS)
+		{
+			pool_drop_locked(it);
+			continue;
+		}
+
+		bytes += it->buf.size;
+		it++;
+	}
+
+	/* Over the limits, idle buffers go first: closing a pending one does not give any memory back */
+	while ((bytes > POOL_MAX_BYTES) || (pool_entries.size() > POOL_MAX_BUFFERS))
+	{
+		auto victim = pool_entries.begin();
+
+		for (auto it = pool_entries.begin(); it != pool_entries.end(); it++)
+		{
+			if (!it->pending)
+			{
+				victim = it;
+				break;
+			}
+		}
+
+		bytes -= victim->buf.size;
+		pool_drop_locked(victim);
+	}
+}
+
+static void *pool_trim_thread(void *arg)
+{
+	GRALLOC_UNUSED(arg);
+
+	pthread_mutex_lock(&pool_lock);
+
+	while (!pool_entries.empty())
+	{
+		/* Entries are only added at the end, so the first one always expires first */
+		uint64_t expiry_ns = pool_entries.front().release_ns + POOL_MAX_AGE_NS + 1;
+		struct timespec expiry;
+
+		expiry.tv_sec = expiry_ns / 1000000000;
+		expiry.tv_nsec = expiry_ns % 1000000000;
+
+		pthread_mutex_unlock(&pool_lock);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &expiry, NULL) == EINTR)
+		{
+		}
+		pthread_mutex_lock(&pool_lock);
+
+		pool_trim_locked(pool_now_ns());
+	}
+
+	pool_trim_thread_running = false;
+	pthread_mutex_unlock(&pool_lock);
+	return NULL;
+}
+
+/* Starts the trim thread if it is not running, it exits by itself once the pool is empty */
+static void pool_arm_trim_locked(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	if (pool_trim_thread_running)
+	{
+		return;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	if (pthread_create(&thread, &attr, pool_trim_thread, NULL) == 0)
+	{
+		pool_trim_thread_running = true;
+	}
+	else
+	{
+		AWAR("Failed to start the buffer pool trim thread");
+	}
+
+	pthread_attr_destroy(&attr);
+}
+
+/* Closes every pooled buffer, returns whether there were any */
+static bool pool_drain(void)
+{
+	bool drained;
+
+	pthread_mutex_lock(&pool_lock);
+	drained = !pool_entries.empty();
+
+	while (!pool_entries.empty())
+	{
+		pool_drop_locked(pool_entries.begin());
+	}
+
+	pthread_mutex_unlock(&pool_lock);
+	return drained;
+}
+
+static int pool_take_locked(unsigned int heap_mask, int flags, size_t size, ion_pool_buffer *buf)
+{
+	int checks = 0;
+	int fd;
+
+	/* The most recently released idle buffer first, then pending ones from the oldest */
+	auto match = pool_entries.end();
+
+	for (auto it = pool_entries.rbegin(); it != pool_entries.rend(); it++)
+	{
+		if (!it->pending && it->buf.heap_mask == heap_mask && it->buf.flags == flags && it->buf.size == size)
+		{
+			match = std::next(it).base();
+			break;
+		}
+	}
+
+	for (auto it = pool_entries.begin(); match == pool_entries.end() && it != pool_entries.end(); it++)
+	{
+		if (!it->pending || it->buf.heap_mask != heap_mask || it->buf.flags != flags || it->buf.size != size)
+		{
+			continue;
+		}
+
+		long count = pool_file_count(it->fd);
+
+		if (count == POOL_UNUSED_FILE_COUNT)
+		{
+			it->pending = false;
+			match = it;
+		}
+		else if (++checks == POOL_MAX_PENDING_CHECKS)
+		{
+			break;
+		}
+	}
+
+	if (match == pool_entries.end())
+	{
+		return -1;
+	}
+
+	fd = match->fd;
+	*buf = match->buf;
+	pool_entries.erase(match);
+	return fd;
+}
+
+/* Enables or disables the pool, fd must be a new buffer nothing but fd refers to */
+static void pool_check_locked(int fd)
+{
+	if (pool_state == POOL_UNKNOWN)
+	{
+		long count = -1;
+
+		if (interface_ver == INTERFACE_ION_MODERN || interface_ver == INTERFACE_DMABUF_HEAPS)
+		{
+			count = pool_file_count(fd);
+		}
+
+		if (count == POOL_UNUSED_FILE_COUNT)
+		{
+			AINF("Buffer pool enabled, %d KB, %d ms", GRALLOC_POOL_MAX_KB, GRALLOC_POOL_MAX_AGE_MS);
+			pool_state = POOL_ENABLED;
+		}
+		else
+		{
+			AINF("Buffer pool disabled, dma-buf reference count of a new buffer is %ld", count);
+			pool_state = POOL_DISABLED;
+		}
+	}
+}
+
+/* Records a buffer allocated by the pool, so that it goes back to the pool when freed */
+static void pool_add_live_locked(int fd, const ion_pool_buffer *buf)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) == 0)
+	{
+		pool_live[st.st_ino] = *buf;
+	}
+}
+
+static int pool_alloc(int ion_fd, size_t size, unsigned int heap_mask, int flags, uint64_t usage, int *min_pgsz)
+{
+	ion_pool_buffer buf;
+	int fd = -1;
+
+	pthread_mutex_lock(&pool_lock);
+
+	/* Buffers are only rounded up to their size class when they go back to the pool */
+	if ((usage & GRALLOC_USAGE_PROTECTED) || pool_state != POOL_ENABLED)
+	{
+		bool check = !(usage & GRALLOC_USAGE_PROTECTED) && pool_state == POOL_UNKNOWN;
+
+		pthread_mutex_unlock(&pool_lock);
+		fd = alloc_from_ion_heap(ion_fd, size, &heap_mask, &flags, min_pgsz);
+
+		if (fd >= 0 && check)
+		{
+			pthread_mutex_lock(&pool_lock);
+			pool_check_locked(fd);
+			pthread_mutex_unlock(&pool_lock);
+		}
+
+		return fd;
+	}
+
+	size = pool_size_class(size);
+	pool_trim_locked(pool_now_ns());
+	fd = pool_take_locked(heap_mask, flags, size, &buf);
+	if (fd >= 0)
+	{
+		pool_add_live_locked(fd, &buf);
+		pool_hits++;
+	}
+	else
+	{
+		pool_misses++;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	if (fd >= 0)
+	{
+		if (!GRALLOC_POOL_ZERO_ON_REUSE || pool_zero(fd, buf.size) == 0)
+		{
+			*min_pgsz = buf.min_pgsz;
+			return fd;
+		}
+
+		close(fd);
+	}
+
+	buf.heap_mask = heap_mask;
+	buf.flags = flags;
+	buf.size = size;
+	fd = alloc_from_ion_heap(ion_fd, size, &buf.heap_mask, &buf.flags, &buf.min_pgsz);
+
+	/* Give the memory held by the pool back before failing */
+	if (fd < 0 && pool_drain())
+	{
+		buf.heap_mask = heap_mask;
+		buf.flags = flags;
+		fd = alloc_from_ion_heap(ion_fd, size, &buf.heap_mask, &buf.flags, &buf.min_pgsz);
+	}
+
+	if (fd >= 0)
+	{
+		pthread_mutex_lock(&pool_lock);
+		pool_add_live_locked(fd, &buf);
+		pthread_mutex_unlock(&pool_lock);
+		*min_pgsz = buf.min_pgsz;
+	}
+
+	return fd;
+}
+
+/* Returns whether the pool took over fd */
+static bool pool_release(int fd)
+{
+	struct stat st;
+	bool taken = false;
+
+	if (fstat(fd, &st) != 0)
+	{
+		return false;
+	}
+
+	pthread_mutex_lock(&pool_lock);
+
+	auto live = pool_live.find(st.st_ino);
+
+	if (pool_state == POOL_ENABLED && live != pool_live.end())
+	{
+		ion_pool_entry entry = { fd, live->second, true, pool_now_ns() };
+
+		pool_live.erase(live);
+		pool_entries.push_back(entry);
+		pool_trim_locked(entry.release_ns);
+		pool_arm_trim_locked();
+		taken = true;
+	}
+
+	pthread_mutex_unlock(&pool_lock);
+	return taken;
+}
+
+void mali_gralloc_ion_pool_get_stats(struct mali_gralloc_ion_pool_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&pool_lock);
+	pool_trim_locked(pool_now_ns());
+
+	stats->enabled = (pool_state != POOL_DISABLED);
+	stats->hits = pool_hits;
+	stats->misses = pool_misses;
+	stats->trimmed = pool_trimmed;
+	stats->max_bytes = POOL_MAX_BYTES;
+
+	for (const ion_pool_entry &entry : pool_entries)
+	{
+		if (entry.pending)
+		{
+			stats->pending_bytes += entry.buf.size;
+			stats->pending_buffers++;
+		}
+		else
+		{
+			stats->idle_bytes += entry.buf.size;
+			stats->idle_buffers++;
+		}
+	}
+
+	pthread_mutex_unlock(&pool_lock);
+}
+
 unsigned int pick_ion_heap(uint64_t usage)
 {
 	unsigned int heap_mask;
@@ -351,13 +837,19 @@ void set_ion_flags(unsigned int heap_mask, uint64_t usage, unsigned int *priv_he
 
 	if (ion_flags)
 	{
+		*ion_flags = 0;
+
 #if defined(ION_HEAP_TYPE_DMA_MASK) && GRALLOC_USE_ION_DMA_HEAP
 
 		if (heap_mask != ION_HEAP_TYPE_DMA_MASK)
 		{
 #endif
 
-			if ((usage & GRALLOC_USAGE_SW_READ_MASK) == GRALLOC_USAGE_SW_READ_OFTEN)
+			/*
+			 * CPU accesses to uncached memory are slow, reads very much so. Buffers with
+			 * any CPU usage are cached, caches are maintained on lock and unlock.
+			 */
+			if (usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK))
 			{
 				*ion_flags = ION_FLAG_CACHED | ION_FLAG_CACHED_NEEDS_SYNC;
 			}
@@ -449,6 +941,7 @@ static int initialize_interface(mali_gralloc_module *m)
 		interface_ver = INTERFACE_DMABUF_HEAPS;
 		system_heap_id = fd;
 		cma_heap_id = dma_heap_open(DMABUF_CMA);
+		system_uncached_heap_id = dma_heap_open(DMABUF_SYSTEM_UNCACHED);
 		/* Open other dma heaps here */
 		return 0;
 	}
@@ -526,7 +1019,7 @@ int mali_gralloc_ion_allocate(mali_gralloc_module *m, const gralloc_buffer_descr
 
 		set_ion_flags(heap_mask, usage, &priv_heap_flag, &ion_flags);
 
-		shared_fd = alloc_from_ion_heap(m->ion_client, max_bufDescriptor->size, heap_mask, ion_flags, &min_pgsz);
+		shared_fd = pool_alloc(m->ion_client, max_bufDescriptor->size, heap_mask, ion_flags, usage, &min_pgsz);
 
 		if (shared_fd < 0)
 		{
@@ -589,7 +1082,7 @@ int mali_gralloc_ion_allocate(mali_gralloc_module *m, const gralloc_buffer_descr
 
 			set_ion_flags(heap_mask, usage, &priv_heap_flag, &ion_flags);
 
-			shared_fd = alloc_from_ion_heap(m->ion_client, bufDescriptor->size, heap_mask, ion_flags, &min_pgsz);
+			shared_fd = pool_alloc(m->ion_client, bufDescriptor->size, heap_mask, ion_flags, usage, &min_pgsz);
 
 			if (shared_fd < 0)
 			{
@@ -626,7 +1119,7 @@ int mali_gralloc_ion_allocate(mali_gralloc_module *m, const gralloc_buffer_descr
 		usage = bufDescriptor->consumer_usage | bufDescriptor->producer_usage;
 		hnd->usage = usage;
 
-		if (!(usage & GRALLOC_USAGE_PROTECTED))
+		if (!(usage & GRALLOC_USAGE_PROTECTED) && mali_gralloc_ion_map_eagerly(usage))
 		{
 			cpu_ptr =
 			    (unsigned char *)mmap(NULL, bufDescriptor->size, PROT_READ | PROT_WRITE, MAP_SHARED, hnd->share_fd, 0);
@@ -638,16 +1131,39 @@ int mali_gralloc_ion_allocate(mali_gralloc_module *m, const gralloc_buffer_descr
 				return -1;
 			}
 
+			hnd->base = cpu_ptr;
+		}
+
 #if GRALLOC_INIT_AFBC == 1
 
-			if ((bufDescriptor->internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK) && (!(*shared_backend)))
+		if (!(usage & GRALLOC_USAGE_PROTECTED) && (bufDescriptor->internal_format & MALI_GRALLOC_INTFMT_AFBCENABLE_MASK) &&
+		    (!(*shared_backend)))
+		{
+			/* Buffers not mapped yet are only mapped for writing the headers */
+			cpu_ptr = (unsigned char *)hnd->base;
+
+			if (NULL == cpu_ptr)
+			{
+				cpu_ptr = (unsigned char *)mmap(NULL, bufDescriptor->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+				                                hnd->share_fd, 0);
+
+				if (MAP_FAILED == cpu_ptr)
+				{
+					AERR("mmap failed from client ( %d ), fd ( %d )", m->ion_client, hnd->share_fd);
+					mali_gralloc_ion_free_internal(pHandle, numDescriptors);
+					return -1;
+				}
+			}
+
+			init_afbc(cpu_ptr, bufDescriptor->internal_format, bufDescriptor->width, bufDescriptor->height);
+
+			if (NULL == hnd->base)
 			{
-				init_afbc(cpu_ptr, bufDescriptor->internal_format, bufDescriptor->width, bufDescriptor->height);
+				munmap(cpu_ptr, bufDescriptor->size);
 			}
+		}
 
 #endif
-			hnd->base = cpu_ptr;
-		}
 	}
 
 	return 0;
@@ -670,7 +1186,11 @@ void mali_gralloc_ion_free(private_handle_t const *hnd)
 			}
 		}
 
-		close(hnd->share_fd);
+		if (!pool_release(hnd->share_fd))
+		{
+			close(hnd->share_fd);
+		}
+
 		memset((void *)hnd, 0, sizeof(*hnd));
 	}
 }
@@ -710,6 +1230,111 @@ void mali_gralloc_ion_sync(const mali_gralloc_module *m, private_handle_t *hnd)
 	}
 }
 
+static void sync_cpu_access(private_handle_t *hnd, uint64_t usage, uint64_t start_end)
+{
+	struct dma_buf_sync sync;
+	int ret;
+
+	if (!(hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION) ||
+	    ((hnd->consumer_usage | hnd->producer_usage) & GRALLOC_USAGE_PROTECTED))
+	{
+		return;
+	}
+
+	sync.flags = start_end;
+
+	if (usage & GRALLOC_USAGE_SW_READ_MASK)
+	{
+		sync.flags |= DMA_BUF_SYNC_READ;
+	}
+
+	if (usage & GRALLOC_USAGE_SW_WRITE_MASK)
+	{
+		sync.flags |= DMA_BUF_SYNC_WRITE;
+	}
+
+	do
+	{
+		ret = ioctl(hnd->share_fd, DMA_BUF_IOCTL_SYNC, &sync);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+	if (ret < 0 && errno != ENOTTY)
+	{
+		AERR("DMA_BUF_IOCTL_SYNC on fd ( %d ) failed with %s", hnd->share_fd, strerror(errno));
+	}
+}
+
+/*
+ * CPU caches are maintained around each lock: the CPU accesses of a lock are
+ * bracketed with DMA_BUF_SYNC_START and DMA_BUF_SYNC_END in the direction of
+ * its usage, so reads see what devices wrote and writes reach the devices.
+ * Legacy ION buffers are only synced after CPU writes, as before.
+ */
+void mali_gralloc_ion_sync_start(const mali_gralloc_module *m, private_handle_t *hnd, uint64_t usage)
+{
+	GRALLOC_UNUSED(m);
+
+	if (interface_ver == INTERFACE_ION_LEGACY || !(usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK)))
+	{
+		return;
+	}
+
+	sync_cpu_access(hnd, usage, DMA_BUF_SYNC_START);
+}
+
+void mali_gralloc_ion_sync_end(const mali_gralloc_module *m, private_handle_t *hnd, uint64_t usage)
+{
+	if (interface_ver == INTERFACE_ION_LEGACY)
+	{
+		if (usage & GRALLOC_USAGE_SW_WRITE_MASK)
+		{
+			mali_gralloc_ion_sync(m, hnd);
+		}
+
+		return;
+	}
+
+	if (!(usage & (GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK)))
+	{
+		return;
+	}
+
+	sync_cpu_access(hnd, usage, DMA_BUF_SYNC_END);
+}
+
+/*
+ * Most buffers are only accessed by the GPU, video and display hardware, so the
+ * CPU mapping is set up on the first lock for CPU access. Buffers expected to be
+ * accessed by the CPU often are mapped as soon as they are allocated or imported.
+ */
+bool mali_gralloc_ion_map_eagerly(uint64_t usage)
+{
+	return ((usage & GRALLOC_USAGE_SW_READ_MASK) == GRALLOC_USAGE_SW_READ_OFTEN) ||
+	       ((usage & GRALLOC_USAGE_SW_WRITE_MASK) == GRALLOC_USAGE_SW_WRITE_OFTEN);
+}
+
+int mali_gralloc_ion_map_lazy(private_handle_t *hnd)
+{
+	static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+	int retval = 0;
+
+	if ((hnd->consumer_usage | hnd->producer_usage) & GRALLOC_USAGE_PROTECTED)
+	{
+		AERR("Protected buffer %p can not be mapped for CPU access", hnd);
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&map_lock);
+
+	if (NULL == hnd->base)
+	{
+		retval = mali_gralloc_ion_map(hnd);
+	}
+
+	pthread_mutex_unlock(&map_lock);
+	return retval;
+}
+
 int mali_gralloc_ion_map(private_handle_t *hnd)
 {
 	int retval = -EINVAL;
@@ -758,7 +1383,8 @@ void mali_gralloc_ion_unmap(private_handle_t *hnd)
 		void *base = (void *)hnd->base;
 		size_t size = hnd->size;
 
-		if (munmap(base, size) < 0)
+		/* Not mapped if never locked for CPU access */
+		if (NULL != base && munmap(base, size) < 0)
 		{
 			AERR("Could not munmap base:%p size:%zd '%s'", base, size, strerror(errno));
 		}
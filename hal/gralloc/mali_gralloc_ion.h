@@ -22,12 +22,30 @@
 #include "mali_gralloc_module.h"
 #include "mali_gralloc_bufferdescriptor.h"
 
+struct mali_gralloc_ion_pool_stats
+{
+	bool enabled;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t trimmed;          /* buffers closed by the pool limits */
+	size_t idle_bytes;         /* ready to be reused */
+	uint32_t idle_buffers;
+	size_t pending_bytes;      /* freed but still referenced elsewhere */
+	uint32_t pending_buffers;
+	size_t max_bytes;
+};
+
 int mali_gralloc_ion_allocate(mali_gralloc_module *m, const gralloc_buffer_descriptor_t *descriptors,
                               uint32_t numDescriptors, buffer_handle_t *pHandle, bool *alloc_from_backing_store);
 void mali_gralloc_ion_free(private_handle_t const *hnd);
 void mali_gralloc_ion_sync(const mali_gralloc_module *m, private_handle_t *hnd);
+void mali_gralloc_ion_sync_start(const mali_gralloc_module *m, private_handle_t *hnd, uint64_t usage);
+void mali_gralloc_ion_sync_end(const mali_gralloc_module *m, private_handle_t *hnd, uint64_t usage);
+bool mali_gralloc_ion_map_eagerly(uint64_t usage);
+int mali_gralloc_ion_map_lazy(private_handle_t *hnd);
 int mali_gralloc_ion_map(private_handle_t *hnd);
 void mali_gralloc_ion_unmap(private_handle_t *hnd);
 int mali_gralloc_ion_device_close(struct hw_device_t *device);
+void mali_gralloc_ion_pool_get_stats(struct mali_gralloc_ion_pool_stats *stats);
 
 #endif /* MALI_GRALLOC_ION_H_ */
@@ -177,6 +177,7 @@ static int32_t mali_gralloc_private_get_attr_param(gralloc1_device_t *device, bu
                                                    int32_t *val, int32_t last_call)
 {
 	GRALLOC_UNUSED(device);
+	GRALLOC_UNUSED(last_call);
 
 	if (private_handle_t::validate(handle) < 0 || val == NULL)
 	{
@@ -188,23 +189,18 @@ static int32_t mali_gralloc_private_get_attr_param(gralloc1_device_t *device, bu
 
 	if (hnd->attr_base == MAP_FAILED)
 	{
-		if (gralloc_buffer_attr_map(hnd, 1) < 0)
+		if (gralloc_buffer_attr_map(hnd, 0) < 0)
 		{
 			return GRALLOC1_ERROR_BAD_HANDLE;
 		}
 	}
 
+	/* The mapping stays cached until the buffer is freed, whatever last_call says */
 	if (gralloc_buffer_attr_read(hnd, attr, val) < 0)
 	{
-		gralloc_buffer_attr_unmap(hnd);
 		return GRALLOC1_ERROR_BAD_HANDLE;
 	}
 
-	if (last_call)
-	{
-		gralloc_buffer_attr_unmap(hnd);
-	}
-
 	return GRALLOC1_ERROR_NONE;
 }
 
@@ -212,6 +208,7 @@ static int32_t mali_gralloc_private_set_attr_param(gralloc1_device_t *device, bu
                                                    int32_t *val, int32_t last_call)
 {
 	GRALLOC_UNUSED(device);
+	GRALLOC_UNUSED(last_call);
 
 	if (private_handle_t::validate(handle) < 0 || val == NULL)
 	{
@@ -221,25 +218,18 @@ static int32_t mali_gralloc_private_set_attr_param(gralloc1_device_t *device, bu
 	const private_handle_t *const_hnd = static_cast<const private_handle_t *>(handle);
 	private_handle_t *hnd = const_cast<private_handle_t *>(const_hnd);
 
-	if (hnd->attr_base == MAP_FAILED)
+	/* Also replaces a read-only mapping left by get_attr_param */
+	if (gralloc_buffer_attr_map(hnd, 1) < 0)
 	{
-		if (gralloc_buffer_attr_map(hnd, 1) < 0)
-		{
-			return GRALLOC1_ERROR_BAD_HANDLE;
-		}
+		return GRALLOC1_ERROR_BAD_HANDLE;
 	}
 
+	/* The mapping stays cached until the buffer is freed, whatever last_call says */
 	if (gralloc_buffer_attr_write(hnd, attr, val) < 0)
 	{
-		gralloc_buffer_attr_unmap(hnd);
 		return GRALLOC1_ERROR_BAD_HANDLE;
 	}
 
-	if (last_call)
-	{
-		gralloc_buffer_attr_unmap(hnd);
-	}
-
 	return GRALLOC1_ERROR_NONE;
 }
 
@@ -57,6 +57,11 @@ int mali_gralloc_reference_retain(mali_gralloc_module const *module, buffer_hand
 	{
 		hnd->remote_pid = getpid();
 		hnd->ref_count = 1;
+		/* Mapped on first attribute access, the address is the one of the exporting process */
+		hnd->attr_base = MAP_FAILED;
+		/* Locks of the exporting process are not ours */
+		hnd->lock_usage = 0;
+		hnd->lock_count = 0;
 	}
 
 	int retval = -EINVAL;
@@ -67,7 +72,14 @@ int mali_gralloc_reference_retain(mali_gralloc_module const *module, buffer_hand
 	}
 	else if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION))
 	{
-		retval = mali_gralloc_ion_map(hnd);
+		/* base is still the address of the exporting process, others are mapped on their first lock */
+		hnd->base = NULL;
+		retval = 0;
+
+		if (mali_gralloc_ion_map_eagerly(hnd->consumer_usage | hnd->producer_usage))
+		{
+			retval = mali_gralloc_ion_map(hnd);
+		}
 	}
 	else
 	{
@@ -144,7 +156,8 @@ int mali_gralloc_reference_release(mali_gralloc_module const *module, buffer_han
 			gralloc_buffer_attr_free(hnd);
 
 			hnd->base = 0;
-			hnd->writeOwner = 0;
+			hnd->lock_usage = 0;
+			hnd->lock_count = 0;
 		}
 	}
 	else